@@ -0,0 +1,58 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BTRACE_DEF_H__
+#define __BTRACE_DEF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Layout of the binary instruction trace written by NEMU with --btrace,
+ * and read by tools/nemu-trace. The file starts with a header padded to
+ * BTRACE_HDR_SIZE bytes, followed by a ring of `nr_slot` records of
+ * `record_size` bytes. Record i is stored at slot (i % nr_slot), so once
+ * the ring wraps, it holds the last `nr_slot` records.
+ */
+
+#define BTRACE_MAGIC    "NEMUBTR"
+#define BTRACE_VERSION  1
+#define BTRACE_HDR_SIZE 4096
+
+// flags
+#define BTRACE_HAS_RD   0x1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  char isa[16];        // e.g. "riscv32"
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t nr_slot;    // a power of 2
+  uint64_t nr_record;  // number of records written so far
+} BTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint32_t inst;
+  // the fields below are only present with BTRACE_HAS_RD
+  uint32_t rd;
+  uint64_t rd_val;     // value of the destination register after execution
+} BTraceRecord;
+
+#define BTRACE_RECORD_SIZE(flags) \
+  (((flags) & BTRACE_HAS_RD) ? sizeof(BTraceRecord) : offsetof(BTraceRecord, rd))
+
+#endif
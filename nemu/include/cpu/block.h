@@ -0,0 +1,42 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_BLOCK_H__
+#define __CPU_BLOCK_H__
+
+#include <common.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_BLOCK_CACHE
+
+#define BLOCK_MAX_INST 64
+
+// set when cached blocks are flushed or dropped while one of them is running
+extern bool block_flushed;
+
+void block_flush();
+// Drop the blocks overlapped by a store to [addr, addr + len),
+// called by a store to a page marked with CODE_BLOCK.
+void block_invalidate(paddr_t addr, int len);
+
+// Execute the block starting at `cpu.pc`, but no more than `n` instructions.
+// Return the number of instructions executed.
+uint64_t block_exec(uint64_t n);
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_BREAKPOINT_H__
+#define __CPU_BREAKPOINT_H__
+
+#include <common.h>
+
+#ifndef CONFIG_TARGET_AM
+/* A byte per hashed instruction address counts the breakpoints there,
+ * so an instruction without breakpoint is passed with a single load.
+ */
+#define BP_FILTER_SIZE 65536
+#define BP_FILTER_IDX(pc) (((pc) >> 2) & (BP_FILTER_SIZE - 1))
+
+extern uint8_t bp_filter[BP_FILTER_SIZE];
+
+bool bp_active();
+// stop if there is a breakpoint at `pc`, the slow path of check_bp()
+bool bp_stop(vaddr_t pc);
+
+// whether there may be a breakpoint at `pc`
+static inline bool bp_maybe(vaddr_t pc) {
+  return bp_filter[BP_FILTER_IDX(pc)] != 0;
+}
+
+// stop before executing the instruction at `pc` if it is a breakpoint
+static inline void check_bp(vaddr_t pc) {
+  if (unlikely(bp_maybe(pc))) bp_stop(pc);
+}
+#endif
+
+#endif
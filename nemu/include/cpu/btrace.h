@@ -0,0 +1,58 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_BTRACE_H__
+#define __CPU_BTRACE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_BTRACE
+#include <cpu/decode.h>
+#include <btrace-def.h>
+
+#define BTRACE_FLAGS MUXDEF(CONFIG_BTRACE_RD, BTRACE_HAS_RD, 0)
+
+extern BTraceHeader *btrace_hdr; // NULL if no trace file is given
+extern uint8_t *btrace_ring;
+extern uint64_t btrace_mask;
+
+void init_btrace(const char *file);
+
+static inline bool btrace_enabled() {
+  return btrace_hdr != NULL;
+}
+
+// the ring is shared by the snapshots, which rewind it on restore
+static inline uint64_t btrace_count() {
+  return btrace_hdr->nr_record;
+}
+
+static inline void btrace_rewind(uint64_t nr_record) {
+  btrace_hdr->nr_record = nr_record;
+}
+
+static inline void btrace_write(Decode *s) {
+  uint64_t i = btrace_hdr->nr_record ++;
+  BTraceRecord *r = (BTraceRecord *)(btrace_ring + (i & btrace_mask) * BTRACE_RECORD_SIZE(BTRACE_FLAGS));
+  r->pc = s->pc;
+  r->inst = s->isa.inst.val;
+#ifdef CONFIG_BTRACE_RD
+  r->rd = s->isa.rd;
+  r->rd_val = cpu.gpr[s->isa.rd];
+#endif
+}
+#endif
+
+#endif
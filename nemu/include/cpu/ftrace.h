@@ -0,0 +1,41 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_FTRACE_H__
+#define __CPU_FTRACE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_FTRACE
+#include <cpu/decode.h>
+
+extern bool ftrace_on;
+
+void init_ftrace(const char *file);
+void ftrace_jump(Decode *s);
+uint64_t ftrace_count();
+void ftrace_rewind(uint64_t nr_event);
+
+static inline bool ftrace_enabled() {
+  return ftrace_on;
+}
+
+// only control transfers can be calls or returns
+static inline void ftrace_hit(Decode *s) {
+  if (unlikely(s->dnpc != s->snpc)) ftrace_jump(s);
+}
+#endif
+
+#endif
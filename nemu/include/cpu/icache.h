@@ -0,0 +1,66 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_ICACHE_H__
+#define __CPU_ICACHE_H__
+
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_ICACHE
+
+// An entry caches the decoding result of the instruction at `pc`.
+typedef struct {
+  vaddr_t pc;
+  ISADecodeInfo isa;
+} ICacheEntry;
+
+// instructions are at least 4-byte aligned, so `pc` can never be -1
+#define ICACHE_INVALID_PC ((vaddr_t)-1)
+#define ICACHE_IDX(pc) (((pc) >> 2) & (CONFIG_ICACHE_SIZE - 1))
+
+extern ICacheEntry icache[CONFIG_ICACHE_SIZE];
+
+void init_icache();
+void icache_flush();
+
+static inline ICacheEntry* icache_lookup(vaddr_t pc) {
+  return &icache[ICACHE_IDX(pc)];
+}
+
+// Called right after an instruction is decoded, before it is executed,
+// so that an instruction overwriting itself will invalidate its own entry.
+// Instructions are not cached while address translation is enabled.
+static inline void icache_fill(Decode *s) {
+  if (likely(in_pmem(s->pc) && isa_mmu_check(s->pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT)) {
+    *icache_lookup(s->pc) = (ICacheEntry){ .pc = s->pc, .isa = s->isa };
+    pmem_code_page[CODE_PAGE_IDX(s->pc)] |= CODE_ICACHE;
+  }
+}
+
+// Drop the entries of instructions overlapped by a store to [addr, addr + len),
+// called by a store to a page marked with CODE_ICACHE.
+static inline void icache_invalidate(paddr_t addr, int len) {
+  paddr_t a;
+  for (a = addr & ~(paddr_t)3; a < addr + len; a += 4) {
+    ICacheEntry *e = icache_lookup(a);
+    if (unlikely(e->pc == a)) { e->pc = ICACHE_INVALID_PC; }
+  }
+}
+
+#endif
+
+#endif
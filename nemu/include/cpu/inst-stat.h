@@ -0,0 +1,34 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_INST_STAT_H__
+#define __CPU_INST_STAT_H__
+
+#include <common.h>
+
+#ifdef CONFIG_INST_STAT
+#include <decode-tree.h> // generated by tools/gen-decode
+
+#define INSTPAT_ID(name) concat(INSTPAT_ID_, name),
+enum { INSTPAT_LIST(INSTPAT_ID) NR_INSTPAT };
+
+// executions of each INSTPAT, indexed by INSTPAT_ID_<name>
+extern uint64_t inst_stat[NR_INSTPAT];
+
+void init_inst_stat(const char *file);
+void inst_stat_report();
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_IRINGBUF_H__
+#define __CPU_IRINGBUF_H__
+
+#include <common.h>
+
+#ifdef CONFIG_IRINGBUF
+#include <cpu/decode.h>
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t inst;
+} IRingEntry;
+
+extern uint64_t g_nr_guest_inst;
+extern IRingEntry iringbuf[CONFIG_IRINGBUF_SIZE];
+extern uint64_t iringbuf_end; // the instructions recorded, including the one in flight
+
+// called once the instruction is fetched and before it is executed, so
+// that an instruction which dies halfway is the last one in the ring
+static inline void iringbuf_write(Decode *s) {
+  iringbuf[g_nr_guest_inst % CONFIG_IRINGBUF_SIZE] = (IRingEntry){ s->pc, s->isa.inst.val };
+  iringbuf_end = g_nr_guest_inst + 1;
+}
+#endif
+
+#endif
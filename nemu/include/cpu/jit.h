@@ -0,0 +1,50 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
+
+#include <cpu/decode.h>
+
+#ifdef CONFIG_ENGINE_JIT
+
+// a block is translated after it is executed this many times
+#define JIT_THRESHOLD 16
+// one in this many runs of a translated block is interpreted instead, and
+// timed with jit_sample() to tell the speedup of the translated code
+#define JIT_SAMPLE_PERIOD 256
+// set in the value returned by jit_run() if the host code stops after
+// an instruction which changes the control flow or the machine state
+#define JIT_STOP 0x80000000u
+
+// Translate the decoded instructions of a block into host code.
+// Return NULL if the code cache is full, in which case all cached blocks are flushed.
+void* jit_translate(Decode *s, int nr_inst);
+// Run the host code of a block. Return the number of instructions executed,
+// possibly or-ed with JIT_STOP. If the host code exits before an instruction
+// it can not handle, `cpu.pc` points to that instruction.
+uint32_t jit_run(void *code);
+void jit_flush();
+// `nr_inst` instructions of a translated block are interpreted in `cycles`
+void jit_sample(uint64_t nr_inst, uint64_t cycles);
+void jit_statistic();
+
+#include <x86intrin.h>
+static inline uint64_t jit_clock() { return __rdtsc(); }
+
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_PROFILE_H__
+#define __CPU_PROFILE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_PROFILE
+#include <cpu/decode.h>
+
+// An entry counts the executions of `pc` under the calling context `ctx`.
+typedef struct {
+  vaddr_t pc;
+  uint32_t ctx;
+  uint64_t count; // 0 means the entry is empty
+} ProfEntry;
+
+extern ProfEntry *prof_table; // NULL if no profile file is given
+extern uint32_t prof_ctx;
+extern int prof_shift;
+
+void init_profile(const char *file);
+void profile_insert(vaddr_t pc);
+void profile_jump(Decode *s);
+
+static inline bool profile_enabled() {
+  return prof_table != NULL;
+}
+
+static inline void profile_hit(Decode *s) {
+  uint64_t h = ((s->pc >> 2) ^ ((uint64_t)prof_ctx << 32)) * 0x9e3779b97f4a7c15ull >> prof_shift;
+  ProfEntry *e = &prof_table[h];
+  if (likely(e->pc == s->pc && e->ctx == prof_ctx && e->count != 0)) {
+    e->count ++;
+  } else {
+    profile_insert(s->pc);
+  }
+  if (unlikely(s->dnpc != s->snpc)) profile_jump(s);
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_SIMPOINT_H__
+#define __CPU_SIMPOINT_H__
+
+#include <common.h>
+
+#ifdef CONFIG_SIMPOINT
+#include <cpu/decode.h>
+
+extern uint64_t g_nr_guest_inst;
+extern bool bbv_on;
+extern uint64_t bbv_len; // instructions of the current block so far
+extern bool simpoint_on;
+extern uint64_t simpoint_next; // where the current interval ends
+
+void init_simpoint(const char *bbv_file, const char *simpoints_file);
+void bbv_jump(vaddr_t target);
+void simpoint_boundary();
+
+static inline bool bbv_enabled() {
+  return bbv_on;
+}
+
+// a block ends at each control transfer
+static inline void bbv_hit(Decode *s) {
+  bbv_len ++;
+  if (unlikely(s->dnpc != s->snpc)) bbv_jump(s->dnpc);
+}
+
+// the number of the next `n` instructions before the end of the interval
+static inline uint64_t simpoint_window(uint64_t n) {
+  if (!simpoint_on) return n;
+  if (g_nr_guest_inst == simpoint_next) simpoint_boundary();
+  uint64_t left = simpoint_next - g_nr_guest_inst;
+  return (n < left ? n : left);
+}
+#endif
+
+#endif
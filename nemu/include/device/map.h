@@ -20,6 +20,10 @@
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+uint8_t* map_save();
+void map_load(const uint8_t *buf);
+// a file opened by a device, whose offset is saved by map_save() too
+void add_map_file(FILE *fp);
 
 typedef struct {
   const char *name;
@@ -52,5 +56,15 @@ void add_mmio_map(const char *name, paddr_t addr,
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+IOMap* mmio_map_list(int *nr);
+IOMap* pio_map_list(int *nr);
+
+/* A checkpoint keeps the space of every map. A device with more state
+ * registers a serializer, which passes each piece of it to ckpt_data()
+ * both when the checkpoint is saved and when it is loaded.
+ */
+typedef void (*io_serializer_t)(bool is_save);
+void add_map_serializer(const char *name, io_serializer_t serializer);
+void map_checkpoint(bool is_save);
 
 #endif
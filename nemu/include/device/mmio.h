@@ -20,5 +20,8 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+#ifdef CONFIG_PMEM_GUARD
+bool mmio_alias(paddr_t page, void *dst);
+#endif
 
 #endif
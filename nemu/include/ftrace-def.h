@@ -0,0 +1,50 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __FTRACE_DEF_H__
+#define __FTRACE_DEF_H__
+
+#include <stdint.h>
+
+/* Layout of the function call trace written by NEMU with --ftrace, and
+ * read by tools/nemu-trace. Like the binary instruction trace, the file
+ * starts with a header padded to FTRACE_HDR_SIZE bytes, followed by a
+ * ring of `nr_slot` events. Event i is stored at slot (i % nr_slot).
+ */
+
+#define FTRACE_MAGIC    "NEMUFTR"
+#define FTRACE_VERSION  1
+#define FTRACE_HDR_SIZE 4096
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  char isa[16];        // e.g. "riscv32"
+  uint64_t nr_slot;    // a power of 2
+  uint64_t nr_event;   // number of events written so far
+} FTraceHeader;
+
+enum { FTRACE_CALL, FTRACE_RET };
+
+typedef struct {
+  uint64_t icount;     // number of instructions executed, including this one
+  uint64_t pc;         // the call or return instruction
+  uint64_t target;
+  uint32_t type;       // FTRACE_CALL or FTRACE_RET
+  uint32_t depth;      // depth of the callee, the root function is at 0
+} FTraceEvent;
+
+#endif
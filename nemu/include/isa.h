@@ -32,10 +32,22 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+// the storage of the register `name`, NULL if there is no such register
+word_t *isa_reg_str2ptr(const char *name);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+// execute an instruction which has been decoded by isa_exec_once()
+int isa_exec_decoded(struct Decode *s);
+// whether the instruction may change the control flow
+bool isa_is_control(struct Decode *s);
+// whether the executed instruction is a call or a return by the ABI convention
+enum { CALL_NONE, CALL_CALL, CALL_RET };
+int isa_call_type(struct Decode *s);
+// the class of the instructions matching an INSTPAT with fixed bits `key` under `mask`
+enum { INST_ALU, INST_LOAD, INST_STORE, INST_CONTROL, INST_SYSTEM, INST_OTHER, NR_INST_CLASS };
+int isa_inst_class(uint32_t key, uint32_t mask);
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -0,0 +1,62 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_ACCESS_H__
+#define __MEMORY_ACCESS_H__
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+/* Loads and stores with the width known at compile time, used by the
+ * instruction bodies. An access to pmem without address translation is
+ * done inline, and the others (MMU, MMIO, out of bound) go to vaddr_read()
+ * and vaddr_write().
+ */
+
+// the host address for an inline access, or NULL to take the slow path
+static inline void* mem_fast_ptr(vaddr_t addr, int len, int type) {
+  if (unlikely(isa_mmu_check(addr, len, type) != MMU_DIRECT)) return NULL;
+#ifdef CONFIG_PMEM_GUARD
+  pmem_guard_len = (type == MEM_TYPE_WRITE ? -len : len);
+#else
+  if (unlikely(!in_pmem(addr))) return NULL;
+#endif
+  return pmem_base + (paddr_t)addr;
+}
+
+#define def_mem_access(len, bits) \
+  static inline uint##bits##_t mem_read_##len(vaddr_t addr) { \
+    void *p = mem_fast_ptr(addr, len, MEM_TYPE_READ); \
+    return (likely(p != NULL) ? *(uint##bits##_t *)p : vaddr_read(addr, len)); \
+  } \
+  static inline int##bits##_t mem_read_s##len(vaddr_t addr) { \
+    return (int##bits##_t)mem_read_##len(addr); \
+  } \
+  static inline void mem_write_##len(vaddr_t addr, uint##bits##_t data) { \
+    void *p = mem_fast_ptr(addr, len, MEM_TYPE_WRITE); \
+    if (unlikely(p == NULL)) { vaddr_write(addr, len, data); return; } \
+    pmem_code_check(addr, len); \
+    *(uint##bits##_t *)p = data; \
+  }
+
+def_mem_access(1, 8)
+def_mem_access(2, 16)
+def_mem_access(4, 32)
+#ifdef CONFIG_ISA64
+def_mem_access(8, 64)
+#endif
+
+#endif
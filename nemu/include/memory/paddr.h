@@ -17,11 +17,15 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/vaddr.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
 #define RESET_VECTOR (PMEM_LEFT + CONFIG_PC_RESET_OFFSET)
 
+/* the host address of guest physical address 0, pmem is at CONFIG_MBASE of it */
+extern uint8_t *pmem_base;
+
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
@@ -31,7 +35,54 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* Pages holding instructions cached by the decode caches, with one bit
+ * for each cache. A store to such a page drops the affected entries.
+ * With PMEM_GUARD a store may be outside pmem before it faults, so the
+ * whole physical address space is covered.
+ */
+enum { CODE_ICACHE = 1, CODE_BLOCK = 2 };
+#ifdef CONFIG_PMEM_GUARD
+#define CODE_PAGE_IDX(addr) ((uint32_t)(addr) >> PAGE_SHIFT)
+#define NR_CODE_PAGE (1ul << (32 - PAGE_SHIFT))
+#else
+#define CODE_PAGE_IDX(addr) (((addr) - CONFIG_MBASE) >> PAGE_SHIFT)
+// one more for a store crossing the end of pmem
+#define NR_CODE_PAGE ((CONFIG_MSIZE >> PAGE_SHIFT) + 1)
+#endif
+extern uint8_t pmem_code_page[NR_CODE_PAGE];
+void pmem_code_write(paddr_t addr, int len);
+void pmem_code_clear(int flag);
+
+static inline void pmem_code_check(paddr_t addr, int len) {
+  if (unlikely(pmem_code_page[CODE_PAGE_IDX(addr)] | pmem_code_page[CODE_PAGE_IDX(addr + len - 1)])) {
+    pmem_code_write(addr, len);
+  }
+}
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 uint32_t getnum(paddr_t paddr);
+/* make sure the host memory of [addr, addr + len) is present before
+ * passing it to the host kernel, e.g. to read() or mmap() into it */
+void pmem_touch(paddr_t addr, size_t len);
+/* whether the chunk of pmem containing addr has been touched, only the
+ * touched ones need to be saved */
+bool pmem_present(paddr_t addr);
+/* for checkpoints, which leave out the pages of pmem still holding what
+ * they are filled with at startup, and fill them again when restored */
+uint64_t pmem_seed();
+void pmem_set_seed(uint64_t seed);
+bool pmem_blank(paddr_t addr, size_t len);
+void pmem_reset(paddr_t addr, size_t len);
+
+#ifdef CONFIG_PMEM_GUARD
+#include <setjmp.h>
+/* set while guest instructions run, so that a fault outside pmem
+ * jumps back to replay the instruction between the two calls below */
+extern sigjmp_buf *pmem_guard_jmp;
+// the length of the access in flight, negative for a write
+extern volatile int pmem_guard_len;
+void pmem_guard_begin();
+void pmem_guard_end();
+#endif
 #endif
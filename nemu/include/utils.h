@@ -33,6 +33,26 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+void set_time(uint64_t us);
+
+// ----------- symbol -----------
+
+// load the function symbols of the guest program from an ELF file
+void init_symbol(const char *elf_file);
+// the function containing `addr`, NULL if unknown; its entry is put in `*start`
+const char* symbol_lookup(vaddr_t addr, vaddr_t *start);
+// the entry of the function `name`
+bool symbol_addr(const char *name, vaddr_t *addr);
+
+// ----------- checkpoint -----------
+
+bool checkpoint_save(const char *file);
+void checkpoint_restore(const char *file);
+// start the next section, whose content is given by the calls below
+void ckpt_section(const char *kind, const char *name);
+void ckpt_data(void *buf, size_t len);
+// like ckpt_data(), but the zero pages are skipped and the rest is compressed
+void ckpt_region(void *buf, size_t len);
 
 // ----------- log -----------
 
@@ -56,6 +76,19 @@ uint64_t get_time();
 
 #define ANSI_FMT(str, fmt) fmt str ANSI_NONE
 
+void log_flush();
+void log_after_fork();
+
+#ifdef CONFIG_LOG_ASYNC
+#define log_write(...) \
+  do { \
+    extern bool log_enable(); \
+    extern void log_printf(const char *fmt, ...); \
+    if (log_enable()) { \
+      log_printf(__VA_ARGS__); \
+    } \
+  } while (0)
+#else
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
     extern FILE* log_fp; \
@@ -66,6 +99,7 @@ uint64_t get_time();
     } \
   } while (0) \
 )
+#endif
 
 #define _Log(...) \
   do { \
@@ -16,6 +16,16 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/block.h>
+#include <cpu/jit.h>
+#include <cpu/btrace.h>
+#include <cpu/profile.h>
+#include <cpu/ftrace.h>
+#include <cpu/inst-stat.h>
+#include <cpu/breakpoint.h>
+#include <cpu/iringbuf.h>
+#include <cpu/simpoint.h>
+#include <memory/paddr.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -30,35 +40,41 @@ uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
+#ifdef CONFIG_DEVICE
+uint64_t device_update();
+static uint64_t device_countdown = 1;
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc)
+// Devices are updated once every `device_update()` returned instructions,
+// to keep reading the host clock out of the hot loop.
+static inline void device_tick(uint64_t nr_inst)
 {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND)
+  if (likely(device_countdown > nr_inst))
   {
-    log_write("%s\n", _this->logbuf);
+    device_countdown -= nr_inst;
+    return;
   }
+  device_countdown = device_update();
+}
 #endif
-  if (g_print_step)
-  {
-    IFDEF(CONFIG_ITRACE, puts(_this->logbuf));
-  }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+
+#ifndef CONFIG_TARGET_AM
+bool wp_active();
+bool scanwp();
+
+static inline void check_wp()
+{
+  if (scanwp() && nemu_state.state == NEMU_RUNNING)
+    nemu_state.state = NEMU_STOP;
 }
+#endif
 
-static void exec_once(Decode *s, vaddr_t pc)
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IRINGBUF)
+// format "pc: bytes  assembly" into `buf`
+static void disasm_inst(char *buf, int size, vaddr_t pc, uint8_t *inst, int ilen)
 {
-  s->pc = pc;
-  s->snpc = pc;
-  isa_exec_once(s);
-  cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", pc);
   int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst.val;
   for (i = ilen - 1; i >= 0; i--)
   {
     p += snprintf(p, 4, " %02x", inst[i]);
@@ -72,25 +88,309 @@ static void exec_once(Decode *s, vaddr_t pc)
   p += space_len;
 
   void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-              MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst.val, ilen);
+  disassemble(p, buf + size - p, MUXDEF(CONFIG_ISA_x86, pc + ilen, pc), inst, ilen);
+}
+#endif
+
+#ifdef CONFIG_IRINGBUF
+/* The last instructions executed are kept raw in a ring indexed by the
+ * instruction count, which costs a single store per instruction. They
+ * are only disassembled when the guest dies.
+ */
+IRingEntry iringbuf[CONFIG_IRINGBUF_SIZE];
+uint64_t iringbuf_end = 0;
+
+static void iringbuf_dump()
+{
+  uint64_t n = (iringbuf_end < CONFIG_IRINGBUF_SIZE ? iringbuf_end : CONFIG_IRINGBUF_SIZE);
+  if (n == 0)
+    return;
+  printf("Last %" PRIu64 " instructions executed:\n", n);
+  uint64_t i;
+  for (i = iringbuf_end - n; i < iringbuf_end; i++)
+  {
+    IRingEntry *e = &iringbuf[i % CONFIG_IRINGBUF_SIZE];
+    char buf[128];
+    disasm_inst(buf, sizeof(buf), e->pc, (uint8_t *)&e->inst, 4);
+    printf("%s %s\n", (i == iringbuf_end - 1 ? "-->" : "   "), buf);
+  }
+}
 #endif
+
+#ifdef CONFIG_BLOCK_CACHE
+static void execute_fast(uint64_t n)
+{
+  while (n > 0)
+  {
+    uint64_t nr_inst = block_exec(n);
+    n -= nr_inst;
+    g_nr_guest_inst += nr_inst;
+    if (nemu_state.state != NEMU_RUNNING)
+      break;
+    IFDEF(CONFIG_DEVICE, device_tick(nr_inst));
+  }
 }
 
+#ifndef CONFIG_TARGET_AM
+// Blocks end before breakpoints when they are recorded, so
+// breakpoints only need to be checked after each block.
+static void execute_break(uint64_t n)
+{
+  while (n > 0)
+  {
+    uint64_t nr_inst = block_exec(n);
+    n -= nr_inst;
+    g_nr_guest_inst += nr_inst;
+    check_bp(cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING)
+      break;
+    IFDEF(CONFIG_DEVICE, device_tick(nr_inst));
+  }
+}
+
+// watchpoints are checked after each instruction,
+// so blocks are executed one instruction at a time
+static void execute_watch(uint64_t n)
+{
+  for (; n > 0; n--)
+  {
+    g_nr_guest_inst += block_exec(1);
+    check_wp();
+    check_bp(cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING)
+      break;
+    IFDEF(CONFIG_DEVICE, device_tick(1));
+  }
+}
+#endif
+
 static void execute(uint64_t n)
+{
+#ifndef CONFIG_TARGET_AM
+  if (wp_active())
+  {
+    execute_watch(n);
+    return;
+  }
+  if (bp_active())
+  {
+    execute_break(n);
+    return;
+  }
+#endif
+  execute_fast(n);
+}
+#else
+#ifdef CONFIG_ITRACE
+static void itrace(Decode *s)
+{
+  disasm_inst(s->logbuf, sizeof(s->logbuf), s->pc, (uint8_t *)&s->isa.inst.val, s->snpc - s->pc);
+
+  if (ITRACE_COND)
+  {
+    log_write("%s\n", s->logbuf);
+  }
+  if (g_print_step)
+  {
+    puts(s->logbuf);
+  }
+}
+#endif
+
+static void exec_once(Decode *s, vaddr_t pc)
+{
+  s->pc = pc;
+  s->snpc = pc;
+  isa_exec_once(s);
+  cpu.pc = s->dnpc;
+}
+
+/* The body shared by all variants of the execute loop. Each variant
+ * passes constant flags, so that the work it does not need is
+ * compiled out of its loop.
+ */
+__attribute__((always_inline))
+static inline void execute_loop(uint64_t n, bool trace, bool btrace, bool ftrace, bool prof, bool bbv, bool diff, bool watch, bool brk)
 {
   Decode s;
   for (; n > 0; n--)
   {
     exec_once(&s, cpu.pc);
     g_nr_guest_inst++;
-    trace_and_difftest(&s, cpu.pc);
+    IFDEF(CONFIG_BTRACE, if (btrace) btrace_write(&s));
+    IFDEF(CONFIG_FTRACE, if (ftrace) ftrace_hit(&s));
+    IFDEF(CONFIG_PROFILE, if (prof) profile_hit(&s));
+    IFDEF(CONFIG_SIMPOINT, if (bbv) bbv_hit(&s));
+    IFDEF(CONFIG_ITRACE, if (trace) itrace(&s));
+    if (diff)
+      difftest_step(s.pc, cpu.pc);
+    IFNDEF(CONFIG_TARGET_AM, if (watch) check_wp());
+    IFNDEF(CONFIG_TARGET_AM, if (brk) check_bp(cpu.pc));
     if (nemu_state.state != NEMU_RUNNING)
       break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, device_tick(1));
   }
 }
 
+#if defined(CONFIG_DIFFTEST)
+static void execute_difftest(uint64_t n, bool trace, bool btrace, bool ftrace, bool prof, bool bbv) { execute_loop(n, trace, btrace, ftrace, prof, bbv, true, false, false); }
+#else
+static void execute_fast(uint64_t n) { execute_loop(n, false, false, false, false, false, false, false, false); }
+#ifdef CONFIG_ITRACE
+static void execute_trace(uint64_t n, bool btrace, bool ftrace, bool prof, bool bbv) { execute_loop(n, true, btrace, ftrace, prof, bbv, false, false, false); }
+#endif
+#ifdef CONFIG_BTRACE
+static void execute_btrace(uint64_t n) { execute_loop(n, false, true, false, false, false, false, false, false); }
+#endif
+#ifdef CONFIG_PROFILE
+static void execute_profile(uint64_t n, bool btrace, bool ftrace, bool bbv) { execute_loop(n, false, btrace, ftrace, true, bbv, false, false, false); }
+#endif
+#ifdef CONFIG_FTRACE
+static void execute_ftrace(uint64_t n, bool btrace, bool bbv) { execute_loop(n, false, btrace, true, false, bbv, false, false, false); }
+#endif
+#ifdef CONFIG_SIMPOINT
+static void execute_bbv(uint64_t n, bool btrace) { execute_loop(n, false, btrace, false, false, true, false, false, false); }
+#endif
+#ifndef CONFIG_TARGET_AM
+static void execute_break(uint64_t n) { execute_loop(n, false, false, false, false, false, false, false, true); }
+#endif
+#endif
+
+#ifndef CONFIG_TARGET_AM
+static void execute_watch(uint64_t n, bool trace, bool btrace, bool ftrace, bool prof, bool bbv)
+{
+  execute_loop(n, trace, btrace, ftrace, prof, bbv, MUXDEF(CONFIG_DIFFTEST, true, false), true, bp_active());
+}
+#endif
+
+/* Decide whether the next instructions are traced, and return how many
+ * of them (at most `n`) share this decision. log_enable() is checked
+ * after an instruction is counted, hence the window is shifted by one.
+ */
+static uint64_t trace_window(uint64_t n, bool *trace)
+{
+  *trace = false;
+#ifdef CONFIG_ITRACE
+  if (g_print_step)
+  {
+    *trace = true;
+    return n;
+  }
+  uint64_t start = (CONFIG_TRACE_START > 0 ? CONFIG_TRACE_START - 1 : 0);
+  uint64_t now = g_nr_guest_inst, len = n;
+  if (now < start)
+    len = start - now;
+  else if (now < CONFIG_TRACE_END)
+  {
+    *trace = true;
+    len = CONFIG_TRACE_END - now;
+  }
+  if (len < n)
+    return len;
+#endif
+  return n;
+}
+
+#define BTRACE_ON MUXDEF(CONFIG_BTRACE, btrace_enabled(), false)
+#define FTRACE_ON MUXDEF(CONFIG_FTRACE, ftrace_enabled(), false)
+#define PROFILE_ON MUXDEF(CONFIG_PROFILE, profile_enabled(), false)
+#define BBV_ON MUXDEF(CONFIG_SIMPOINT, bbv_enabled(), false)
+
+/* Run the leanest variant of the loop which does what is enabled now,
+ * so that `c` without watchpoints outside the trace window runs fast
+ * even if the tracers are compiled in.
+ */
+static void execute(uint64_t n)
+{
+  while (n > 0 && nemu_state.state == NEMU_RUNNING)
+  {
+    bool trace;
+    uint64_t len = trace_window(n, &trace);
+#ifdef CONFIG_SIMPOINT
+    // an interval may end and stop NEMU here
+    len = simpoint_window(len);
+    if (nemu_state.state != NEMU_RUNNING)
+      break;
+#endif
+    n -= len;
+#ifndef CONFIG_TARGET_AM
+    if (wp_active() || bp_active())
+    {
+#ifndef CONFIG_DIFFTEST
+      // a breakpoint alone costs a single load per instruction
+      if (!wp_active() && !trace && !BTRACE_ON && !FTRACE_ON && !PROFILE_ON && !BBV_ON)
+      {
+        execute_break(len);
+        continue;
+      }
+#endif
+      execute_watch(len, trace, BTRACE_ON, FTRACE_ON, PROFILE_ON, BBV_ON);
+      continue;
+    }
+#endif
+#if defined(CONFIG_DIFFTEST)
+    execute_difftest(len, trace, BTRACE_ON, FTRACE_ON, PROFILE_ON, BBV_ON);
+#else
+#ifdef CONFIG_ITRACE
+    if (trace)
+    {
+      execute_trace(len, BTRACE_ON, FTRACE_ON, PROFILE_ON, BBV_ON);
+      continue;
+    }
+#endif
+#ifdef CONFIG_PROFILE
+    if (PROFILE_ON)
+    {
+      execute_profile(len, BTRACE_ON, FTRACE_ON, BBV_ON);
+      continue;
+    }
+#endif
+#ifdef CONFIG_FTRACE
+    if (FTRACE_ON)
+    {
+      execute_ftrace(len, BTRACE_ON, BBV_ON);
+      continue;
+    }
+#endif
+#ifdef CONFIG_SIMPOINT
+    if (BBV_ON)
+    {
+      execute_bbv(len, BTRACE_ON);
+      continue;
+    }
+#endif
+#ifdef CONFIG_BTRACE
+    if (BTRACE_ON)
+    {
+      execute_btrace(len);
+      continue;
+    }
+#endif
+    execute_fast(len);
+#endif
+  }
+}
+#endif
+
+#ifdef CONFIG_PMEM_GUARD
+static void execute_guarded(uint64_t n)
+{
+  uint64_t end = (n > UINT64_MAX - g_nr_guest_inst ? UINT64_MAX : g_nr_guest_inst + n);
+  sigjmp_buf jmp;
+  if (sigsetjmp(jmp, 1))
+  {
+    // an access outside pmem faulted, the instruction did not take effect
+    pmem_guard_jmp = NULL;
+    pmem_guard_begin();
+    execute(1);
+    pmem_guard_end();
+  }
+  pmem_guard_jmp = &jmp;
+  execute(end - g_nr_guest_inst);
+  pmem_guard_jmp = NULL;
+}
+#endif
+
 static void statistic()
 {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
@@ -101,12 +401,17 @@ static void statistic()
     Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else
     Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+  IFDEF(CONFIG_INST_STAT, inst_stat_report());
 }
 
 void assert_fail_msg()
 {
+  IFDEF(CONFIG_IRINGBUF, iringbuf_dump());
   isa_reg_display();
   statistic();
+  // assert() aborts without flushing a piped stdout
+  fflush(stdout);
 }
 
 /* Simulate how the CPU works. */
@@ -117,7 +422,7 @@ void cpu_exec(uint64_t n)
   {
   case NEMU_END:
   case NEMU_ABORT:
-    printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
+    printf("Program execution has ended. To restart the program, restore a snapshot, or exit NEMU and run again.\n");
     return;
   default:
     nemu_state.state = NEMU_RUNNING;
@@ -125,7 +430,7 @@ void cpu_exec(uint64_t n)
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+  MUXDEF(CONFIG_PMEM_GUARD, execute_guarded, execute)(n);
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -138,11 +443,16 @@ void cpu_exec(uint64_t n)
 
   case NEMU_END:
   case NEMU_ABORT:
+#ifdef CONFIG_IRINGBUF
+    if (nemu_state.state == NEMU_ABORT || nemu_state.halt_ret != 0)
+      iringbuf_dump();
+#endif
     Log("nemu: %s at pc = " FMT_WORD,
         (nemu_state.state == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) : (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) : ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
         nemu_state.halt_pc);
     // fall through
   case NEMU_QUIT:
     statistic();
+    log_flush();
   }
 }
@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <cpu/icache.h>
+
+#ifdef CONFIG_ICACHE
+
+ICacheEntry icache[CONFIG_ICACHE_SIZE] = {};
+
+void icache_flush() {
+  int i;
+  for (i = 0; i < CONFIG_ICACHE_SIZE; i ++) {
+    icache[i].pc = ICACHE_INVALID_PC;
+  }
+  pmem_code_clear(CODE_ICACHE);
+}
+
+void init_icache() {
+  static_assert((CONFIG_ICACHE_SIZE & (CONFIG_ICACHE_SIZE - 1)) == 0,
+      "CONFIG_ICACHE_SIZE should be a power of 2");
+  icache_flush();
+  Log("Decoded instruction cache: %d entries", CONFIG_ICACHE_SIZE);
+}
+
+#endif
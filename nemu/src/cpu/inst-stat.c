@@ -0,0 +1,111 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_INST_STAT
+#include <isa.h>
+#include <cpu/inst-stat.h>
+
+/* Every INSTPAT counts its executions at its execution label, so the
+ * counts are exact for the interpreter, with or without the decoded
+ * instruction cache, and for the block engine. The fixed bits of each
+ * pattern come from tools/gen-decode, and are used to put the pattern
+ * into a class with isa_inst_class().
+ */
+
+uint64_t inst_stat[NR_INSTPAT] = {};
+
+typedef struct {
+  const char *name;
+  uint32_t key, mask;
+} PatInfo;
+
+#define INSTPAT_INFO(name, key, mask) { str(name), key, mask },
+static const PatInfo pat_info[NR_INSTPAT] = { INSTPAT_KEYS(INSTPAT_INFO) };
+
+static const char *class_name[NR_INST_CLASS] = {
+  [INST_ALU] = "alu", [INST_LOAD] = "load", [INST_STORE] = "store",
+  [INST_CONTROL] = "control", [INST_SYSTEM] = "system", [INST_OTHER] = "other",
+};
+
+static const char *stat_file = NULL;
+
+void init_inst_stat(const char *file) {
+  stat_file = file;
+}
+
+static int count_cmp(const void *a, const void *b) {
+  uint64_t x = inst_stat[*(const int *)a], y = inst_stat[*(const int *)b];
+  return (x < y) - (x > y);
+}
+
+static void write_file(const char *file, const int *order, const uint64_t *class_count) {
+  const char *ext = strrchr(file, '.');
+  bool json = (ext != NULL && strcmp(ext, ".json") == 0);
+  FILE *fp = fopen(file, "w");
+  Assert(fp, "Can not open '%s'", file);
+  int i;
+  if (json) {
+    fprintf(fp, "{\n  \"classes\": {");
+    for (i = 0; i < NR_INST_CLASS; i ++) {
+      fprintf(fp, "%s\n    \"%s\": %" PRIu64, (i == 0 ? "" : ","), class_name[i], class_count[i]);
+    }
+    fprintf(fp, "\n  },\n  \"instructions\": [");
+    for (i = 0; i < NR_INSTPAT; i ++) {
+      const PatInfo *p = &pat_info[order[i]];
+      fprintf(fp, "%s\n    { \"name\": \"%s\", \"class\": \"%s\", \"count\": %" PRIu64 " }",
+          (i == 0 ? "" : ","), p->name, class_name[isa_inst_class(p->key, p->mask)], inst_stat[order[i]]);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+  } else {
+    fprintf(fp, "name,class,count\n");
+    for (i = 0; i < NR_INSTPAT; i ++) {
+      const PatInfo *p = &pat_info[order[i]];
+      fprintf(fp, "%s,%s,%" PRIu64 "\n", p->name,
+          class_name[isa_inst_class(p->key, p->mask)], inst_stat[order[i]]);
+    }
+  }
+  fclose(fp);
+}
+
+void inst_stat_report() {
+  int order[NR_INSTPAT], i;
+  uint64_t class_count[NR_INST_CLASS] = {}, total = 0;
+  for (i = 0; i < NR_INSTPAT; i ++) {
+    order[i] = i;
+    class_count[isa_inst_class(pat_info[i].key, pat_info[i].mask)] += inst_stat[i];
+    total += inst_stat[i];
+  }
+  if (total == 0) return;
+  qsort(order, NR_INSTPAT, sizeof(order[0]), count_cmp);
+
+  Log("instruction mix:");
+  for (i = 0; i < NR_INST_CLASS; i ++) {
+    if (class_count[i] == 0) continue;
+    Log("  %-8s %'16" PRIu64 " %6.2f%%", class_name[i], class_count[i], 100.0 * class_count[i] / total);
+  }
+  Log("executions of each instruction:");
+  for (i = 0; i < NR_INSTPAT && inst_stat[order[i]] != 0; i ++) {
+    Log("  %-12s %'16" PRIu64 " %6.2f%%", pat_info[order[i]].name,
+        inst_stat[order[i]], 100.0 * inst_stat[order[i]] / total);
+  }
+
+  if (stat_file != NULL) {
+    write_file(stat_file, order, class_count);
+    Log("Instruction statistics are written to %s", stat_file);
+  }
+}
+#endif
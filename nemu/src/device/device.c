@@ -33,11 +33,37 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
-void device_update() {
+#define POLL_PERIOD (1000000 / TIMER_HZ / 4) // unit: us
+#define POLL_INTERVAL_MIN 1024
+#define POLL_INTERVAL_MAX (1ull << 26)
+
+#ifdef CONFIG_DEVICE_POLL_ADAPTIVE
+// Scale the interval towards one device update every POLL_PERIOD us,
+// at most by a factor of 2 each time, so that a pause in the debugger
+// does not throw it away.
+static uint64_t adjust_interval(uint64_t interval, uint64_t elapsed) {
+  uint64_t target = (elapsed == 0 ? interval * 2 : interval * POLL_PERIOD / elapsed);
+  if (target < interval / 2) target = interval / 2;
+  if (target > interval * 2) target = interval * 2;
+  if (target < POLL_INTERVAL_MIN) target = POLL_INTERVAL_MIN;
+  if (target > POLL_INTERVAL_MAX) target = POLL_INTERVAL_MAX;
+  return target;
+}
+#endif
+
+// Return the number of guest instructions to execute
+// before this function should be called again.
+uint64_t device_update() {
   static uint64_t last = 0;
+  static uint64_t interval = CONFIG_DEVICE_POLL_INTERVAL;
   uint64_t now = get_time();
+#ifdef CONFIG_DEVICE_POLL_ADAPTIVE
+  static uint64_t last_poll = 0;
+  if (last_poll != 0) interval = adjust_interval(interval, now - last_poll);
+  last_poll = now;
+#endif
   if (now - last < 1000000 / TIMER_HZ) {
-    return;
+    return interval;
   }
   last = now;
 
@@ -64,6 +90,7 @@ void device_update() {
     }
   }
 #endif
+  return interval;
 }
 
 void sdl_clear_event_queue() {
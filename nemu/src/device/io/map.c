@@ -13,6 +13,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#define _GNU_SOURCE // memfd_create()
 #include <isa.h>
 #include <memory/host.h>
 #include <memory/vaddr.h>
@@ -23,6 +24,21 @@
 static uint8_t *io_space = NULL;
 static uint8_t *p_space = NULL;
 
+#ifdef CONFIG_PMEM_GUARD
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the io space is backed by a memory file,
+// so that its pages can be mapped at another address as well
+static int io_space_fd = -1;
+
+bool map_alias(void *dst, uint8_t *space) {
+  if (space < io_space || space >= p_space || ((uintptr_t)space & PAGE_MASK) != 0) return false;
+  void *p = mmap(dst, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, io_space_fd, space - io_space);
+  return p != MAP_FAILED;
+}
+#endif
+
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
   // page aligned;
@@ -32,6 +48,44 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+#define NR_FILE 4
+
+static FILE *files[NR_FILE] = {};
+static int nr_file = 0;
+
+void add_map_file(FILE *fp) {
+  assert(nr_file < NR_FILE);
+  files[nr_file ++] = fp;
+}
+
+// a copy of the state of all devices, which a snapshot keeps for itself
+// since the io space may be shared with the processes forked from it,
+// followed by the offsets of the files, which are shared as well
+uint8_t* map_save() {
+  size_t size = p_space - io_space;
+  uint8_t *buf = malloc(size + sizeof(long) * NR_FILE);
+  assert(buf);
+  if (size > 0) memcpy(buf, io_space, size);
+  long *off = (long *)(buf + size);
+  int i;
+  for (i = 0; i < nr_file; i ++) {
+    // nothing may be left in the buffer to be written at another offset
+    fflush(files[i]);
+    off[i] = ftell(files[i]);
+  }
+  return buf;
+}
+
+void map_load(const uint8_t *buf) {
+  size_t size = p_space - io_space;
+  if (size > 0) memcpy(io_space, buf, size);
+  const long *off = (const long *)(buf + size);
+  int i;
+  for (i = 0; i < nr_file; i ++) {
+    if (off[i] >= 0) fseek(files[i], off[i], SEEK_SET);
+  }
+}
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -47,8 +101,15 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
+#ifdef CONFIG_PMEM_GUARD
+  io_space_fd = memfd_create("io_space", 0);
+  assert(io_space_fd >= 0 && ftruncate(io_space_fd, IO_SPACE_MAX) == 0);
+  io_space = mmap(NULL, IO_SPACE_MAX, PROT_READ | PROT_WRITE, MAP_SHARED, io_space_fd, 0);
+  assert(io_space != MAP_FAILED);
+#else
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
+#endif
   p_space = io_space;
 }
 
@@ -68,3 +129,41 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
+
+#define NR_SERIALIZER 8
+
+static struct {
+  const char *name;
+  io_serializer_t serializer;
+} serializers[NR_SERIALIZER] = {};
+static int nr_serializer = 0;
+
+void add_map_serializer(const char *name, io_serializer_t serializer) {
+  assert(nr_serializer < NR_SERIALIZER);
+  serializers[nr_serializer].name = name;
+  serializers[nr_serializer].serializer = serializer;
+  nr_serializer ++;
+}
+
+#ifdef CONFIG_CHECKPOINT
+static void map_list_checkpoint(const char *kind, IOMap *maps, int nr) {
+  int i;
+  for (i = 0; i < nr; i ++) {
+    ckpt_section(kind, maps[i].name);
+    ckpt_region(maps[i].space, maps[i].high - maps[i].low + 1);
+  }
+}
+
+void map_checkpoint(bool is_save) {
+  int nr;
+  IOMap *maps = mmio_map_list(&nr);
+  map_list_checkpoint("mmio", maps, nr);
+  maps = pio_map_list(&nr);
+  map_list_checkpoint("pio", maps, nr);
+  int i;
+  for (i = 0; i < nr_serializer; i ++) {
+    ckpt_section("device", serializers[i].name);
+    serializers[i].serializer(is_save);
+  }
+}
+#endif
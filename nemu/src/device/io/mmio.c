@@ -14,16 +14,84 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
 #define NR_MAP 16
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
+/* The physical address space outside pmem is described by a radix table
+ * of pages. A page covered by a single map without callback, e.g. the
+ * frame buffer, is accessed through its host address directly. Several
+ * small maps may share a page, then the map of each byte is recorded.
+ */
+typedef struct {
+  uint8_t *host; // host address of the page if it can be accessed directly
+  IOMap *map;    // the only map in this page
+  uint8_t *id;   // index + 1 of the map of each byte, if the page is shared
+} MMIOPage;
+
+#define PAGE_BITS 10
+#define NR_PAGE (1 << PAGE_BITS)
+#define TOP_SHIFT (PAGE_SHIFT + PAGE_BITS)
+#define NR_TOP (1 << (32 - TOP_SHIFT))
+
+static MMIOPage *mmio_table[NR_TOP] = {};
+
+static inline MMIOPage* page_lookup(paddr_t addr) {
+  // devices are placed below 4GB
+  if (MUXDEF(PMEM64, (addr >> 32) != 0, false)) return NULL;
+  MMIOPage *t = mmio_table[(uint32_t)addr >> TOP_SHIFT];
+  return (t == NULL ? NULL : &t[(addr >> PAGE_SHIFT) & (NR_PAGE - 1)]);
+}
+
+static MMIOPage* page_alloc(paddr_t addr) {
+  MMIOPage **t = &mmio_table[(uint32_t)addr >> TOP_SHIFT];
+  if (*t == NULL) {
+    *t = calloc(NR_PAGE, sizeof(MMIOPage));
+    assert(*t);
+  }
+  return &(*t)[(addr >> PAGE_SHIFT) & (NR_PAGE - 1)];
+}
+
+static void set_page_id(MMIOPage *p, paddr_t page, IOMap *map) {
+  paddr_t l = (map->low > page ? map->low : page);
+  paddr_t r = (map->high < page + PAGE_MASK ? map->high : page + PAGE_MASK);
+  memset(p->id + (l - page), map - maps + 1, r - l + 1);
+}
+
+static void add_map_pages(IOMap *map) {
+  paddr_t page = map->low & ~(paddr_t)PAGE_MASK;
+  uint64_t nr = ((map->high >> PAGE_SHIFT) - (map->low >> PAGE_SHIFT)) + 1;
+  for (; nr > 0; nr --, page += PAGE_SIZE) {
+    MMIOPage *p = page_alloc(page);
+    if (p->map == NULL && p->id == NULL) {
+      bool whole = (map->low <= page && map->high >= page + PAGE_MASK);
+      p->map = map;
+      p->host = (whole && map->callback == NULL ? (uint8_t *)map->space + (page - map->low) : NULL);
+      continue;
+    }
+    if (p->id == NULL) {
+      // the page becomes shared
+      p->id = calloc(PAGE_SIZE, 1);
+      assert(p->id);
+      set_page_id(p, page, p->map);
+      p->map = NULL;
+      p->host = NULL;
+    }
+    set_page_id(p, page, map);
+  }
+}
+
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  MMIOPage *p = page_lookup(addr);
+  if (p == NULL) return NULL;
+  IOMap *map = (p->id == NULL ? p->map : (p->id[addr & PAGE_MASK] ? &maps[p->id[addr & PAGE_MASK] - 1] : NULL));
+  if (map != NULL) difftest_skip_ref();
+  return map;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -47,17 +115,44 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
 
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
+  add_map_pages(&maps[nr_map]);
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
   nr_map ++;
 }
 
+IOMap* mmio_map_list(int *nr) {
+  *nr = nr_map;
+  return maps;
+}
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
+  MMIOPage *p = page_lookup(addr);
+  if (likely(p != NULL && p->host != NULL)) {
+    difftest_skip_ref();
+    return host_read(p->host + (addr & PAGE_MASK), len);
+  }
   return map_read(addr, len, fetch_mmio_map(addr));
 }
 
+#ifdef CONFIG_PMEM_GUARD
+bool map_alias(void *dst, uint8_t *space);
+
+// Map the page at `page` also to `dst` if it can be accessed directly.
+bool mmio_alias(paddr_t page, void *dst) {
+  MMIOPage *p = page_lookup(page);
+  return (p != NULL && p->host != NULL && map_alias(dst, p->host));
+}
+#endif
+
 void mmio_write(paddr_t addr, int len, word_t data) {
+  MMIOPage *p = page_lookup(addr);
+  if (likely(p != NULL && p->host != NULL)) {
+    difftest_skip_ref();
+    host_write(p->host + (addr & PAGE_MASK), len, data);
+    return;
+  }
   map_write(addr, len, data, fetch_mmio_map(addr));
 }
@@ -33,6 +33,11 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+IOMap* pio_map_list(int *nr) {
+  *nr = nr_map;
+  return maps;
+}
+
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
@@ -64,6 +64,14 @@ static uint32_t key_dequeue() {
   return key;
 }
 
+#ifdef CONFIG_CHECKPOINT
+static void key_serializer(bool is_save) {
+  ckpt_data(key_queue, sizeof(key_queue));
+  ckpt_data(&key_f, sizeof(key_f));
+  ckpt_data(&key_r, sizeof(key_r));
+}
+#endif
+
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
@@ -97,4 +105,5 @@ void init_i8042() {
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFDEF(CONFIG_CHECKPOINT, add_map_serializer("keyboard", key_serializer));
 }
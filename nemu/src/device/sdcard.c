@@ -122,13 +122,27 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+#ifdef CONFIG_CHECKPOINT
+static void sdcard_serializer(bool is_save) {
+  ckpt_data(&blkcnt, sizeof(blkcnt));
+  ckpt_data(&blk_addr, sizeof(blk_addr));
+  ckpt_data(&addr, sizeof(addr));
+  ckpt_data(&write_cmd, sizeof(write_cmd));
+  ckpt_data(&read_ext_csd, sizeof(read_ext_csd));
+  // the image is at where the transfer in progress has reached
+  if (!is_save && fp) fseek(fp, (blk_addr << 9) + addr, SEEK_SET);
+}
+#endif
+
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  IFDEF(CONFIG_CHECKPOINT, add_map_serializer("sdhci", sdcard_serializer));
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
   const char *img = CONFIG_SDCARD_IMG_PATH;
   fp = fopen(img, "r+");
   if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  else add_map_file(fp);
 }
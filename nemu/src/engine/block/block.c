@@ -0,0 +1,157 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
+#include <cpu/block.h>
+#include <cpu/jit.h>
+#include <cpu/breakpoint.h>
+
+#define NR_BLOCK 4096
+#define POOL_SIZE (64 * 1024)
+
+typedef struct {
+  vaddr_t pc;
+  int nr_inst; // 0 means the entry is invalid
+  Decode *inst;
+#ifdef CONFIG_ENGINE_JIT
+  uint32_t nr_exec;
+  void *code; // translated host code
+#endif
+} Block;
+
+static Block blocks[NR_BLOCK] = {};
+// decoded instructions of all cached blocks, allocated linearly
+static Decode pool[POOL_SIZE] = {};
+static int pool_idx = 0;
+bool block_flushed = false;
+
+static inline Block* block_lookup(vaddr_t pc) {
+  return &blocks[(pc >> 2) & (NR_BLOCK - 1)];
+}
+
+void block_flush() {
+  memset(blocks, 0, sizeof(blocks));
+  pmem_code_clear(CODE_BLOCK);
+  pool_idx = 0;
+  block_flushed = true;
+  IFDEF(CONFIG_ENGINE_JIT, jit_flush());
+}
+
+/* A block never crosses a page, and is found at the slot of its pc, so a
+ * block overlapping the store starts at one of the BLOCK_MAX_INST slots
+ * before the stored address in the same page.
+ */
+void block_invalidate(paddr_t addr, int len) {
+  paddr_t end = addr + len;
+  paddr_t page = addr & ~(paddr_t)PAGE_MASK;
+  paddr_t pc = addr & ~(paddr_t)3;
+  pc = (pc - page >= (BLOCK_MAX_INST - 1) * 4 ? pc - (BLOCK_MAX_INST - 1) * 4 : page);
+  for (; pc < end; pc += 4) {
+    Block *b = block_lookup(pc);
+    if (b->pc == pc && b->nr_inst != 0 && pc + b->nr_inst * 4 > addr) {
+      b->nr_inst = 0;
+      IFDEF(CONFIG_ENGINE_JIT, b->code = NULL);
+      block_flushed = true;
+    }
+  }
+}
+
+// Execute instructions one by one from `cpu.pc` and record them,
+// until the end of the straight-line run. The recorded block is
+// cached only if it is not cut by `n`.
+static uint64_t block_record(uint64_t n) {
+  vaddr_t start = cpu.pc;
+  if (pool_idx + BLOCK_MAX_INST > POOL_SIZE) { block_flush(); }
+  Decode *inst = pool + pool_idx;
+  block_flushed = false;
+
+  int i;
+  bool end = false;
+  for (i = 0; i < n && !end; i ++) {
+    Decode *s = inst + i;
+    s->pc = s->snpc = cpu.pc;
+    isa_exec_once(s);
+    cpu.pc = s->dnpc;
+    IFDEF(CONFIG_DIFFTEST, difftest_step(s->pc, s->dnpc));
+    end = isa_is_control(s) || s->dnpc != s->snpc || nemu_state.state != NEMU_RUNNING ||
+      i + 1 == BLOCK_MAX_INST || ((s->snpc ^ start) >> PAGE_SHIFT) != 0
+      // breakpoints are only checked between blocks
+      IFNDEF(CONFIG_TARGET_AM, || bp_maybe(s->dnpc));
+  }
+
+  // blocks are not cached while address translation is enabled
+  if (end && !block_flushed && in_pmem(start) &&
+      isa_mmu_check(start, 4, MEM_TYPE_IFETCH) == MMU_DIRECT) {
+    *block_lookup(start) = (Block) { .pc = start, .nr_inst = i, .inst = inst };
+    pmem_code_page[CODE_PAGE_IDX(start)] |= CODE_BLOCK;
+    pool_idx += i;
+  }
+  return i;
+}
+
+static int block_replay(Decode *s, int nr_inst) {
+  int i;
+  for (i = 0; i < nr_inst; i ++, s ++) {
+    isa_exec_decoded(s);
+#ifdef CONFIG_DIFFTEST
+    difftest_step(s->pc, s->dnpc);
+    if (nemu_state.state != NEMU_RUNNING) { i ++; s ++; break; }
+#endif
+    // the rest of the block is skipped if this instruction redirects
+    // the control flow or modifies the code of the cached blocks
+    if (unlikely(s->dnpc != s->snpc || block_flushed)) { i ++; s ++; break; }
+  }
+  cpu.pc = (s - 1)->dnpc;
+  return i;
+}
+
+uint64_t block_exec(uint64_t n) {
+  Block *b = block_lookup(cpu.pc);
+  if (b->pc != cpu.pc || b->nr_inst == 0) {
+    return block_record(n);
+  }
+
+  int nr_inst = (n < b->nr_inst ? n : b->nr_inst);
+  Decode *s = b->inst;
+  block_flushed = false;
+
+#ifdef CONFIG_ENGINE_JIT
+  if (nr_inst == b->nr_inst) {
+    if (b->code == NULL && ++ b->nr_exec == JIT_THRESHOLD) {
+      b->code = jit_translate(s, nr_inst);
+    }
+    if (b->code != NULL) {
+      if (unlikely(b->nr_exec ++ % JIT_SAMPLE_PERIOD == 0)) {
+        uint64_t t = jit_clock();
+        int i = block_replay(s, nr_inst);
+        jit_sample(i, jit_clock() - t);
+        return i;
+      }
+      uint32_t ret = jit_run(b->code);
+      int i = ret & ~JIT_STOP;
+      if ((ret & JIT_STOP) || i == nr_inst) { return i; }
+      // the host code exits before an instruction it can not handle,
+      // e.g. MMIO, and the rest of the block is interpreted
+      return i + block_replay(s + i, nr_inst - i);
+    }
+  }
+#endif
+
+  return block_replay(s, nr_inst);
+}
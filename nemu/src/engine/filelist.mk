@@ -15,3 +15,8 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+
+# the block engine shares the host calls and the entry with the interpreter
+DIRS-$(CONFIG_BLOCK_CACHE) += src/engine/interpreter
+# the JIT engine translates the blocks cached by the block engine
+DIRS-$(CONFIG_ENGINE_JIT) += src/engine/block
@@ -0,0 +1,231 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/block.h>
+#include <cpu/jit.h>
+#include <memory/paddr.h>
+#include <sys/mman.h>
+#include <stddef.h>
+
+#ifndef __x86_64__
+#error "the JIT engine only supports x86-64 hosts"
+#endif
+
+#define CODE_CACHE_SIZE (16 * 1024 * 1024)
+// upper bound of the host code of a guest instruction, including its exit stub
+#define MAX_INST_CODE 160
+#define MAX_BLOCK_CODE(nr_inst) (64 + (nr_inst) * MAX_INST_CODE)
+
+// host registers holding the arguments during the whole block
+//   rbx: &cpu
+//   r12: the host address of the beginning of pmem
+//   r13: pmem_code_page
+typedef uint32_t (*HostBlock)(CPU_state *c, uint8_t *pmem, uint8_t *code_page);
+
+static uint8_t *code_cache = NULL;
+static uint8_t *code_ptr = NULL;
+static uint64_t nr_translated = 0, nr_native_inst = 0;
+// TSC cycles spent in translated code, and in the interpreted samples
+static uint64_t native_cycles = 0, sample_cycles = 0, nr_sample_inst = 0;
+
+extern uint64_t g_nr_guest_inst;
+
+#define OFF_GPR(i) ((uint32_t)(offsetof(CPU_state, gpr) + (i) * sizeof(word_t)))
+#define OFF_PC ((uint32_t)offsetof(CPU_state, pc))
+
+// --- x86-64 code emitter ---
+
+static uint8_t *p = NULL;
+
+static inline void emit8(uint8_t x) { *p ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static inline void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+#define emit(...) do { \
+  const uint8_t __b[] = { __VA_ARGS__ }; \
+  memcpy(p, __b, sizeof(__b)); p += sizeof(__b); \
+} while (0)
+
+// return the position of the rel32 to patch
+static inline uint8_t* emit_jcc(uint8_t cc) { emit(0x0f, cc); emit32(0); return p - 4; }
+static inline void patch_rel32(uint8_t *rel, uint8_t *target) {
+  uint32_t off = target - (rel + 4);
+  memcpy(rel, &off, 4);
+}
+
+#define JA  0x87
+#define JNZ 0x85
+
+// mov dword [rbx + disp32], imm32
+static void emit_store_imm(uint32_t disp, uint32_t imm) { emit(0xc7, 0x83); emit32(disp); emit32(imm); }
+// mov ecx, [rbx + OFF_GPR(rs1)]; add ecx, imm; sub ecx, MBASE; cmp ecx, MSIZE - len; ja slow
+static uint8_t* emit_addr(int rs1, word_t imm, int len) {
+  emit(0x8b, 0x8b); emit32(OFF_GPR(rs1));
+  emit(0x81, 0xc1); emit32(imm);
+  emit(0x81, 0xe9); emit32(CONFIG_MBASE);
+  emit(0x81, 0xf9); emit32(CONFIG_MSIZE - len);
+  return emit_jcc(JA);
+}
+
+typedef struct {
+  uint8_t *rel;
+  vaddr_t pc;
+  uint32_t ret;
+} ExitStub;
+
+static ExitStub stubs[BLOCK_MAX_INST * 3];
+static int nr_stub = 0;
+
+static void add_stub(uint8_t *rel, vaddr_t pc, uint32_t ret) {
+  stubs[nr_stub ++] = (ExitStub) { .rel = rel, .pc = pc, .ret = ret };
+}
+
+// Execute an instruction which is not translated into host code.
+// Return non-zero if the block should stop after it.
+static uint32_t jit_helper(Decode *s) {
+  isa_exec_decoded(s);
+  cpu.pc = s->dnpc;
+  return s->dnpc != s->snpc || nemu_state.state != NEMU_RUNNING || block_flushed;
+}
+
+// --- translation ---
+
+static bool translate_lw(Decode *s, int i) {
+  // the load falls back to the interpreter if it is not inside pmem, e.g. MMIO
+  add_stub(emit_addr(s->isa.rs1, s->isa.imm, 4), s->pc, i);
+  emit(0x41, 0x8b, 0x04, 0x0c);                         // mov eax, [r12 + rcx]
+  if (s->isa.rd != 0) { emit(0x89, 0x83); emit32(OFF_GPR(s->isa.rd)); } // mov [rbx + rd], eax
+  return true;
+}
+
+static bool translate_sw(Decode *s, int i) {
+  add_stub(emit_addr(s->isa.rs1, s->isa.imm, 4), s->pc, i);
+  // also fall back if the store is misaligned or touches cached code
+  emit(0xf6, 0xc1, 0x03);                               // test cl, 3
+  add_stub(emit_jcc(JNZ), s->pc, i);
+  emit(0x89, 0xca);                                     // mov edx, ecx
+  emit(0xc1, 0xea, PAGE_SHIFT);                         // shr edx, PAGE_SHIFT
+  emit(0x41, 0x0f, 0xb6, 0x54, 0x15, 0x00);             // movzx edx, byte [r13 + rdx]
+  emit(0x85, 0xd2);                                     // test edx, edx
+  add_stub(emit_jcc(JNZ), s->pc, i);
+  emit(0x8b, 0x83); emit32(OFF_GPR(s->isa.rs2));        // mov eax, [rbx + rs2]
+  emit(0x41, 0x89, 0x04, 0x0c);                         // mov [r12 + rcx], eax
+  return true;
+}
+
+static bool translate_native(Decode *s, int i) {
+  uint32_t inst = s->isa.inst.val;
+  switch (BITS(inst, 6, 0)) {
+    case 0x37: // lui
+      if (s->isa.rd != 0) { emit_store_imm(OFF_GPR(s->isa.rd), s->isa.imm); }
+      return true;
+    case 0x03: return BITS(inst, 14, 12) == 2 && translate_lw(s, i);
+    case 0x23: return BITS(inst, 14, 12) == 2 && translate_sw(s, i);
+    default: return false;
+  }
+}
+
+static void translate_helper(Decode *s, int i) {
+  emit(0x48, 0xbf); emit64((uintptr_t)s);               // mov rdi, s
+  emit(0x48, 0xb8); emit64((uintptr_t)jit_helper);      // mov rax, jit_helper
+  emit(0xff, 0xd0);                                     // call rax
+  emit(0x85, 0xc0);                                     // test eax, eax
+  add_stub(emit_jcc(JNZ), 0, (i + 1) | JIT_STOP);
+}
+
+void* jit_translate(Decode *s, int nr_inst) {
+  if (code_cache == NULL) {
+    code_cache = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(code_cache != MAP_FAILED, "Can not allocate the code cache");
+    code_ptr = code_cache;
+  }
+  if (code_ptr + MAX_BLOCK_CODE(nr_inst) > code_cache + CODE_CACHE_SIZE) {
+    block_flush();
+    return NULL;
+  }
+
+  uint8_t *code = code_ptr;
+  p = code;
+  nr_stub = 0;
+
+  emit(0x53, 0x41, 0x54, 0x41, 0x55);                   // push rbx; push r12; push r13
+  emit(0x48, 0x89, 0xfb);                               // mov rbx, rdi
+  emit(0x49, 0x89, 0xf4);                               // mov r12, rsi
+  emit(0x49, 0x89, 0xd5);                               // mov r13, rdx
+
+  int i;
+  bool native = false;
+  for (i = 0; i < nr_inst; i ++) {
+    native = translate_native(s + i, i);
+    if (!native) { translate_helper(s + i, i); }
+  }
+  // the helper has already updated the pc
+  if (native) { emit_store_imm(OFF_PC, s[nr_inst - 1].snpc); }
+  emit(0xb8); emit32(nr_inst);                          // mov eax, nr_inst
+
+  uint8_t *epilogue = p;
+  emit(0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);             // pop r13; pop r12; pop rbx; ret
+
+  for (i = 0; i < nr_stub; i ++) {
+    patch_rel32(stubs[i].rel, p);
+    if ((stubs[i].ret & JIT_STOP) == 0) { emit_store_imm(OFF_PC, stubs[i].pc); }
+    emit(0xb8); emit32(stubs[i].ret);                   // mov eax, ret
+    emit(0xe9); emit32(0);                              // jmp epilogue
+    patch_rel32(p - 4, epilogue);
+  }
+
+  assert(p <= code + MAX_BLOCK_CODE(nr_inst));
+  code_ptr = p;
+  nr_translated ++;
+  return code;
+}
+
+uint32_t jit_run(void *code) {
+  uint64_t t = jit_clock();
+  uint32_t ret = ((HostBlock)code)(&cpu, guest_to_host(CONFIG_MBASE), pmem_code_page);
+  native_cycles += jit_clock() - t;
+  nr_native_inst += ret & ~JIT_STOP;
+  return ret;
+}
+
+void jit_flush() {
+  code_ptr = code_cache;
+}
+
+void jit_sample(uint64_t nr_inst, uint64_t cycles) {
+  nr_sample_inst += nr_inst;
+  sample_cycles += cycles;
+}
+
+void jit_statistic() {
+  Log("translated blocks = %" PRIu64 ", code cache used = %ld bytes",
+      nr_translated, (long)(code_ptr - code_cache));
+  if (g_nr_guest_inst > 0) {
+    Log("guest instructions run by translated code = %" PRIu64 " (%.1f%%)",
+        nr_native_inst, nr_native_inst * 100.0 / g_nr_guest_inst);
+  }
+  // the same blocks are compared, so the speedup does not depend on the
+  // share of the instructions which are translated
+  if (nr_native_inst > 0 && nr_sample_inst > 0 && native_cycles > 0) {
+    double native = (double)native_cycles / nr_native_inst;
+    double interp = (double)sample_cycles / nr_sample_inst;
+    Log("cycles per instruction: translated = %.2f, interpreted = %.2f, speedup = %.2fx",
+        native, interp, interp / native);
+  }
+}
@@ -21,6 +21,7 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  word_t satp;
 } riscv32_CPU_state;
 
 // decode
@@ -28,8 +29,13 @@ typedef struct {
   union {
     uint32_t val;
   } inst;
+  const void *exec; // entry of the execution body of the matched pattern
+  uint8_t rd, rs1, rs2;
+  word_t imm;
 } riscv32_ISADecodeInfo;
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+// Sv32 translation is enabled by satp.MODE
+#define isa_mmu_check(vaddr, len, type) \
+  MUXDEF(CONFIG_MODE_SYSTEM, ((cpu.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT), MMU_DIRECT)
 
 #endif
@@ -30,4 +30,9 @@ static inline const char* reg_name(int idx, int width) {
   return regs[check_reg_idx(idx)];
 }
 
+#define CSR_SATP 0x180
+
+word_t csr_read(uint32_t addr);
+void csr_write(uint32_t addr, word_t val);
+
 #endif
@@ -57,3 +57,15 @@ word_t isa_reg_str2val(const char *s, bool *success)
   *success = false;
   return 0;
 }
+
+word_t *isa_reg_str2ptr(const char *s)
+{
+  for (int i = 0; i < ARRLEN(regs); i++)
+  {
+    if (strcmp(regs[i], s) == 0)
+    {
+      return &gpr(i);
+    }
+  }
+  return NULL;
+}
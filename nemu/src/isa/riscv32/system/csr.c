@@ -0,0 +1,37 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/vaddr.h>
+#include "../local-include/reg.h"
+
+word_t csr_read(uint32_t addr) {
+  switch (addr) {
+    case CSR_SATP: return cpu.satp;
+    default: panic("CSR 0x%03x is not supported at pc = " FMT_WORD, addr, cpu.pc);
+  }
+  return 0;
+}
+
+void csr_write(uint32_t addr, word_t val) {
+  switch (addr) {
+    case CSR_SATP:
+      cpu.satp = val;
+      // everything cached by virtual address becomes stale
+      tlb_flush();
+      break;
+    default: panic("CSR 0x%03x is not supported at pc = " FMT_WORD, addr, cpu.pc);
+  }
+}
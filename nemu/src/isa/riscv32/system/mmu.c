@@ -17,6 +17,49 @@
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
 
+// Sv32 page table entry
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_U 0x10
+#define PTE_G 0x20
+#define PTE_A 0x40
+#define PTE_D 0x80
+
+#define PTE_PPN(pte) ((pte) >> 10)
+#define VPN(vaddr, level) (((vaddr) >> (PAGE_SHIFT + 10 * (level))) & 0x3ff)
+
+/* Walk the Sv32 page table. On success, return the base address of the
+ * physical page, which is 4KB even for a megapage, or'ed with MEM_RET_OK.
+ * The accessed and dirty bits are updated by the walker, so that entries
+ * in the TLB never need to set them again.
+ */
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  static const word_t perm[] = {
+    [MEM_TYPE_IFETCH] = PTE_X, [MEM_TYPE_READ] = PTE_R, [MEM_TYPE_WRITE] = PTE_W,
+  };
+  paddr_t table = (paddr_t)(cpu.satp & 0x3fffff) << PAGE_SHIFT;
+  int level;
+  for (level = 1; level >= 0; level --) {
+    paddr_t pte_addr = table + VPN(vaddr, level) * 4;
+    word_t pte = paddr_read(pte_addr, 4);
+    if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) return MEM_RET_FAIL;
+
+    if (pte & (PTE_R | PTE_X)) {
+      // a leaf entry
+      if (!(pte & perm[type])) return MEM_RET_FAIL;
+      word_t ppn = PTE_PPN(pte);
+      if (level == 1) {
+        // a misaligned megapage
+        if (ppn & 0x3ff) return MEM_RET_FAIL;
+        ppn |= VPN(vaddr, 0);
+      }
+      word_t new_pte = pte | PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+      if (new_pte != pte) paddr_write(pte_addr, 4, new_pte);
+      return ((paddr_t)ppn << PAGE_SHIFT) | MEM_RET_OK;
+    }
+    table = (paddr_t)PTE_PPN(pte) << PAGE_SHIFT;
+  }
   return MEM_RET_FAIL;
 }
@@ -28,6 +28,9 @@ typedef struct {
   union {
     uint32_t val;
   } inst;
+  const void *exec; // entry of the execution body of the matched pattern
+  uint8_t rd, rs1, rs2;
+  word_t imm;
 } riscv64_ISADecodeInfo;
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
@@ -17,47 +17,74 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/icache.h>
+#include <cpu/inst-stat.h>
+#include <cpu/iringbuf.h>
+#include <memory/access.h>
+#ifdef CONFIG_DECODE_TREE
+#include <decode-tree.h> // generated by tools/gen-decode
+#endif
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+// specialized by the width, which is always a constant
+#define Mr(addr, len) concat(mem_read_, len)(addr)
+#define Mw(addr, len, data) concat(mem_write_, len)(addr, data)
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
-static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type) {
+// Only the static part of the operands is decoded here. The register
+// operands are read when the instruction is executed, so that the
+// decoding result can be reused the next time this instruction is executed.
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst.val;
-  int rd  = BITS(i, 11, 7);
-  int rs1 = BITS(i, 19, 15);
-  int rs2 = BITS(i, 24, 20);
-  *dest = rd;
+  word_t *imm = &s->isa.imm;
+  s->isa.rd  = BITS(i, 11, 7);
+  s->isa.rs1 = BITS(i, 19, 15);
+  s->isa.rs2 = BITS(i, 24, 20);
+  *imm = 0;
   switch (type) {
-    case TYPE_I: src1R();          immI(); break;
-    case TYPE_U:                   immU(); break;
-    case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_I: immI(); break;
+    case TYPE_U: immU(); break;
+    case TYPE_S: immS(); break;
   }
 }
 
 static int decode_exec(Decode *s) {
-  int dest = 0;
-  word_t src1 = 0, src2 = 0, imm = 0;
+  int dest;
+  word_t src1, src2, imm;
   s->dnpc = s->snpc;
+  IFDEF(CONFIG_IRINGBUF, iringbuf_write(s));
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  decode_operand(s, &dest, &src1, &src2, &imm, concat(TYPE_, type)); \
+IFDEF(CONFIG_DECODE_TREE, concat(__instpat_decode_, name):) \
+  decode_operand(s, concat(TYPE_, type)); \
+  s->isa.exec = &&concat(__instpat_exec_, name); \
+  IFDEF(CONFIG_ICACHE, icache_fill(s)); \
+concat(__instpat_exec_, name): \
+  dest = s->isa.rd; src1 = R(s->isa.rs1); src2 = R(s->isa.rs2); imm = s->isa.imm; \
   __VA_ARGS__ ; \
+  /* counted once it completes, as a faulting access may be replayed */ \
+  IFDEF(CONFIG_INST_STAT, inst_stat[concat(INSTPAT_ID_, name)] ++); \
 }
 
   INSTPAT_START();
+  // the instruction is already decoded, skip pattern matching
+  if (s->isa.exec != NULL) goto *s->isa.exec;
+#ifdef CONFIG_DECODE_TREE
+#define INSTPAT_ENTRY(name) &&concat(__instpat_decode_, name),
+  // jump to the first matching pattern found by the decode tree
+  static const void *decode_entry[] = { INSTPAT_LIST(INSTPAT_ENTRY) };
+  int idx = decode_tree(INSTPAT_INST(s));
+  if (likely(idx >= 0)) goto *decode_entry[idx];
+#endif
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(dest) = s->pc + imm);
   INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld     , I, R(dest) = Mr(src1 + imm, 8));
   INSTPAT("??????? ????? ????? 011 ????? 01000 11", sd     , S, Mw(src1 + imm, 8, src2));
@@ -72,6 +99,56 @@ static int decode_exec(Decode *s) {
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_ICACHE
+  ICacheEntry *e = icache_lookup(s->pc);
+  if (likely(e->pc == s->pc)) {
+    s->isa = e->isa;
+    s->snpc += 4;
+    return decode_exec(s);
+  }
+#endif
+  s->isa.exec = NULL;
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
+
+int isa_exec_decoded(Decode *s) {
+  return decode_exec(s);
+}
+
+bool isa_is_control(Decode *s) {
+  switch (BITS(s->isa.inst.val, 6, 0)) {
+    case 0x63: // branch
+    case 0x67: // jalr
+    case 0x6f: // jal
+    case 0x73: // system
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ra or t0 is the link register of a call, see the hints of jal and jalr
+int isa_call_type(Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  int rd = BITS(i, 11, 7), rs1 = BITS(i, 19, 15);
+  bool rd_link = (rd == 1 || rd == 5), rs1_link = (rs1 == 1 || rs1 == 5);
+  switch (BITS(i, 6, 0)) {
+    case 0x6f: return (rd_link ? CALL_CALL : CALL_NONE); // jal
+    case 0x67: return (rd_link ? CALL_CALL : (rs1_link ? CALL_RET : CALL_NONE)); // jalr
+    default: return CALL_NONE;
+  }
+}
+
+int isa_inst_class(uint32_t key, uint32_t mask) {
+  if ((mask & 0x7f) != 0x7f) return INST_OTHER;
+  switch (key & 0x7f) {
+    case 0x03: case 0x07: return INST_LOAD;  // load, load-fp
+    case 0x23: case 0x27: return INST_STORE; // store, store-fp
+    case 0x63: case 0x67: case 0x6f: return INST_CONTROL; // branch, jalr, jal
+    case 0x73: case 0x0f: return INST_SYSTEM; // system, fence
+    case 0x13: case 0x1b: case 0x33: case 0x3b: // op-imm(-32), op(-32)
+    case 0x17: case 0x37: return INST_ALU; // auipc, lui
+    default: return INST_OTHER;
+  }
+}
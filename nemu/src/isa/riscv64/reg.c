@@ -30,3 +30,8 @@ word_t isa_reg_str2val(const char *s, bool *success)
 {
   return 0;
 }
+
+word_t *isa_reg_str2ptr(const char *s)
+{
+  return NULL;
+}
@@ -16,13 +16,250 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <cpu/icache.h>
+#include <cpu/block.h>
 #include <isa.h>
 
-#if defined(CONFIG_PMEM_MALLOC)
+#if defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
+uint8_t *pmem_base = NULL;
+
+#if defined(CONFIG_PMEM_MMAP) || defined(CONFIG_CHECKPOINT)
+#include <sys/mman.h>
+#endif
+
+#ifdef CONFIG_PMEM_MMAP
+#include <signal.h>
+#include <unistd.h>
+#include <memory/vaddr.h>
+
+// the unit of lazy initialization, also the size of a transparent huge page
+#define PMEM_CHUNK (2ul << 20)
+#endif
+
+#ifdef CONFIG_MEM_RANDOM
+static uint64_t rand_seed = 0;
+
+/* Every word is a hash of its index, so the loop vectorizes, and the
+ * content of a chunk does not depend on the order the chunks are filled.
+ */
+static inline uint64_t random_word(uint64_t idx)
+{
+  uint64_t z = idx * 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static void fill_random(uint8_t *host, size_t len)
+{
+  uint64_t *p = (uint64_t *)host;
+  uint64_t base = rand_seed + (host - pmem) / sizeof(p[0]);
+  size_t i;
+  for (i = 0; i < len / sizeof(p[0]); i++)
+  {
+    p[i] = random_word(base + i);
+  }
+}
+
+#ifdef CONFIG_PMEM_MMAP
+/* pmem is reserved with PROT_NONE, and a chunk is made accessible and
+ * filled when it is touched for the first time.
+ */
+static bool chunk_ready[(CONFIG_MSIZE + PMEM_CHUNK - 1) / PMEM_CHUNK] = {};
+
+static void chunk_init(size_t idx)
+{
+  uint8_t *host = pmem + idx * PMEM_CHUNK;
+  size_t len = CONFIG_MSIZE - idx * PMEM_CHUNK;
+  if (len > PMEM_CHUNK)
+    len = PMEM_CHUNK;
+  if (mprotect(host, len, PROT_READ | PROT_WRITE) != 0)
+    abort();
+  fill_random(host, len);
+  chunk_ready[idx] = true;
+}
+#endif
+#endif
+
+#ifdef CONFIG_PMEM_GUARD
+#ifdef PMEM64
+#error PMEM_GUARD only supports a 32-bit physical address space
+#endif
+
+/* pmem sits at its guest address in a window covering the whole physical
+ * address space, and the rest of the window is PROT_NONE. Accesses index
+ * the window without checking the address, and one outside pmem faults.
+ * The execute loop is armed by setting pmem_guard_jmp, then the fault
+ * jumps back to it, and the instruction is executed again between
+ * pmem_guard_begin() and pmem_guard_end() with the page made accessible.
+ */
+#define GUARD_WINDOW (1ull << 32)
+
+static uint8_t *guard_base = NULL;
+sigjmp_buf *pmem_guard_jmp = NULL;
+// length of the access in flight, negative for a write
+volatile int pmem_guard_len = 0;
+// the access which faulted, and the size of the scratch mapping for it
+static paddr_t fault_addr = 0;
+static int fault_len = 0;
+static size_t scratch_size = 0;
+#endif
+
+#if defined(CONFIG_PMEM_MMAP) && (defined(CONFIG_MEM_RANDOM) || defined(CONFIG_PMEM_GUARD))
+static struct sigaction old_segv;
+
+static void pmem_segv_handler(int sig, siginfo_t *info, void *ucontext)
+{
+  uint8_t *addr = info->si_addr;
+  bool is_pmem = (addr >= pmem && addr < pmem + CONFIG_MSIZE);
+#ifdef CONFIG_MEM_RANDOM
+  if (is_pmem && !chunk_ready[(addr - pmem) / PMEM_CHUNK])
+  {
+    chunk_init((addr - pmem) / PMEM_CHUNK);
+    return;
+  }
+#endif
+#ifdef CONFIG_PMEM_GUARD
+  if (!is_pmem && addr >= guard_base && addr < guard_base + GUARD_WINDOW)
+  {
+    fault_addr = addr - guard_base;
+    fault_len = pmem_guard_len;
+    if (pmem_guard_jmp != NULL)
+      siglongjmp(*pmem_guard_jmp, 1);
+    // not from a guest instruction, e.g. from the debugger or a device.
+    // Only async-signal-safe calls here, then the fault kills NEMU
+    char msg[] = "address = 0x???????? is out of bound of pmem outside the guest instructions\n";
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+      msg[sizeof("address = 0x") - 1 + i] = "0123456789abcdef"[(fault_addr >> (28 - i * 4)) & 0xf];
+    }
+    ssize_t ret = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)ret;
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+#endif
+  // not ours, let the fault happen again with the previous handler
+  sigaction(SIGSEGV, &old_segv, NULL);
+}
+#endif
+
+void pmem_touch(paddr_t addr, size_t len)
+{
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+  if (len == 0)
+    return;
+  size_t idx;
+  for (idx = (addr - CONFIG_MBASE) / PMEM_CHUNK; idx <= (addr + len - 1 - CONFIG_MBASE) / PMEM_CHUNK; idx++)
+  {
+    if (!chunk_ready[idx])
+      chunk_init(idx);
+  }
+#endif
+}
+
+// an untouched chunk is not present, and its content is made up when touched
+bool pmem_present(paddr_t addr)
+{
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+  return chunk_ready[(addr - CONFIG_MBASE) / PMEM_CHUNK];
+#else
+  return true;
+#endif
+}
+
+#ifdef CONFIG_CHECKPOINT
+uint64_t pmem_seed()
+{
+  return MUXDEF(CONFIG_MEM_RANDOM, rand_seed, 0);
+}
+
+void pmem_set_seed(uint64_t seed)
+{
+  IFDEF(CONFIG_MEM_RANDOM, rand_seed = seed);
+}
+
+// whether [addr, addr + len) still holds what it is filled with at startup
+bool pmem_blank(paddr_t addr, size_t len)
+{
+  if (!pmem_present(addr))
+    return true;
+  uint8_t *host = guest_to_host(addr);
+#ifdef CONFIG_MEM_RANDOM
+  uint64_t *p = (uint64_t *)host;
+  uint64_t base = rand_seed + (host - pmem) / sizeof(p[0]);
+  size_t i;
+  for (i = 0; i < len / sizeof(p[0]); i++)
+  {
+    if (p[i] != random_word(base + i))
+      return false;
+  }
+  return true;
+#else
+  static const uint8_t zero_page[PAGE_SIZE] = {};
+  size_t off;
+  for (off = 0; off < len; off += PAGE_SIZE)
+  {
+    size_t n = (len - off < PAGE_SIZE ? len - off : PAGE_SIZE);
+    if (memcmp(host + off, zero_page, n) != 0)
+      return false;
+  }
+  return true;
+#endif
+}
+
+// fill [addr, addr + len) again as it is at startup
+void pmem_reset(paddr_t addr, size_t len)
+{
+  uint8_t *host = guest_to_host(addr);
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+  // whole chunks are dropped, and they are filled again when touched
+  size_t off = host - pmem;
+  size_t l = ROUNDUP(off, PMEM_CHUNK);
+  size_t r = (off + len == CONFIG_MSIZE ? CONFIG_MSIZE : ROUNDDOWN(off + len, PMEM_CHUNK));
+  if (l >= r)
+  {
+    pmem_touch(addr, len);
+    fill_random(host, len);
+    return;
+  }
+  void *p = mmap(pmem + l, r - l, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map the pages at " FMT_PADDR, host_to_guest(pmem + l));
+  IFDEF(CONFIG_PMEM_HUGEPAGE, madvise(p, r - l, MADV_HUGEPAGE));
+  memset(&chunk_ready[l / PMEM_CHUNK], 0, (r - l + PMEM_CHUNK - 1) / PMEM_CHUNK);
+  pmem_touch(addr, pmem + l - host);
+  fill_random(host, pmem + l - host);
+  pmem_touch(host_to_guest(pmem + r), host + len - (pmem + r));
+  fill_random(pmem + r, host + len - (pmem + r));
+#elif defined(CONFIG_MEM_RANDOM)
+  fill_random(host, len);
+#else
+  uint8_t *l = (uint8_t *)ROUNDUP(host, PAGE_SIZE);
+  uint8_t *r = (uint8_t *)ROUNDDOWN(host + len, PAGE_SIZE);
+  if (l >= r)
+  {
+    memset(host, 0, len);
+    return;
+  }
+  // whole pages are dropped, and they are zero when touched again
+#ifdef CONFIG_PMEM_MMAP
+  // a page may be mapped from the image, which madvise() would bring back
+  void *p = mmap(l, r - l, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map the pages at " FMT_PADDR, host_to_guest(l));
+#else
+  int ret = madvise(l, r - l, MADV_DONTNEED);
+  Assert(ret == 0, "Can not drop the pages at " FMT_PADDR, host_to_guest(l));
+#endif
+  memset(host, 0, l - host);
+  memset(r, 0, host + len - r);
+#endif
+}
+#endif
 
 uint8_t *guest_to_host(paddr_t paddr)
 {
@@ -35,6 +272,7 @@ uint32_t getnum(paddr_t paddr)
   uint32_t val = *(uint32_t *)(pmem + paddr - CONFIG_MBASE);
   return val;
 }
+#ifndef CONFIG_PMEM_GUARD
 static word_t pmem_read(paddr_t addr, int len)
 {
   word_t ret = host_read(guest_to_host(addr), len);
@@ -45,6 +283,7 @@ static void pmem_write(paddr_t addr, int len, word_t data)
 {
   host_write(guest_to_host(addr), len, data);
 }
+#endif
 
 static void out_of_bound(paddr_t addr)
 {
@@ -57,34 +296,146 @@ void init_mem()
 #if defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  int prot = MUXDEF(CONFIG_MEM_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE);
+#ifdef CONFIG_PMEM_GUARD
+  // reserve one more chunk to align the window to the huge page size
+  size_t size = GUARD_WINDOW + PMEM_CHUNK;
+  uint8_t *p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "Can not reserve the guarded window for pmem");
+  guard_base = (uint8_t *)ROUNDUP((uintptr_t)p, PMEM_CHUNK);
+  if (guard_base > p)
+    munmap(p, guard_base - p);
+  munmap(guard_base + GUARD_WINDOW, p + size - (guard_base + GUARD_WINDOW));
+  pmem = guard_base + CONFIG_MBASE;
+  if (prot != PROT_NONE)
+    mprotect(pmem, CONFIG_MSIZE, prot);
+#else
+  // reserve one more chunk to align pmem to the huge page size
+  size_t size = CONFIG_MSIZE + PMEM_CHUNK;
+  uint8_t *p = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "Can not reserve %#lx bytes for pmem", (unsigned long)CONFIG_MSIZE);
+  pmem = (uint8_t *)ROUNDUP((uintptr_t)p, PMEM_CHUNK);
+  if (pmem > p)
+    munmap(p, pmem - p);
+  munmap(pmem + CONFIG_MSIZE, p + size - (pmem + CONFIG_MSIZE));
+#endif
+  IFDEF(CONFIG_PMEM_HUGEPAGE, madvise(pmem, CONFIG_MSIZE, MADV_HUGEPAGE));
 #endif
 #ifdef CONFIG_MEM_RANDOM
-  uint32_t *p = (uint32_t *)pmem;
-  int i;
-  for (i = 0; i < (int)(CONFIG_MSIZE / sizeof(p[0])); i++)
-  {
-    p[i] = rand();
-  }
+  rand_seed = ((uint64_t)rand() << 32) | rand();
+  IFNDEF(CONFIG_PMEM_MMAP, fill_random(pmem, CONFIG_MSIZE));
+#endif
+#if defined(CONFIG_PMEM_MMAP) && (defined(CONFIG_MEM_RANDOM) || defined(CONFIG_PMEM_GUARD))
+  struct sigaction sa = {.sa_sigaction = pmem_segv_handler, .sa_flags = SA_SIGINFO};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, &old_segv);
 #endif
+  pmem_base = (uint8_t *)((uintptr_t)pmem - CONFIG_MBASE);
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len)
+uint8_t pmem_code_page[NR_CODE_PAGE] = {};
+
+// a store hits a page with cached code
+void pmem_code_write(paddr_t addr, int len)
+{
+  IFDEF(CONFIG_ICACHE, icache_invalidate(addr, len));
+  IFDEF(CONFIG_BLOCK_CACHE, block_invalidate(addr, len));
+}
+
+// called when a cache is flushed
+void pmem_code_clear(int flag)
+{
+  size_t i;
+  for (i = 0; i < NR_CODE_PAGE; i++)
+  {
+    pmem_code_page[i] &= ~flag;
+  }
+}
+
+static word_t paddr_read_slow(paddr_t addr, int len)
 {
-  if (likely(in_pmem(addr)))
-    return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
+static void paddr_write_slow(paddr_t addr, int len, word_t data)
+{
+  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  out_of_bound(addr);
+}
+
+#ifdef CONFIG_PMEM_GUARD
+word_t paddr_read(paddr_t addr, int len)
+{
+  pmem_guard_len = len;
+  return host_read(guard_base + addr, len);
+}
+
+void paddr_write(paddr_t addr, int len, word_t data)
+{
+  pmem_guard_len = -len;
+  pmem_code_check(addr, len);
+  host_write(guard_base + addr, len, data);
+}
+
+void pmem_guard_begin()
+{
+  paddr_t addr = fault_addr;
+  int len = (fault_len < 0 ? -fault_len : fault_len);
+  paddr_t page = addr & ~(paddr_t)PAGE_MASK;
+  if ((addr & PAGE_MASK) + len > PAGE_SIZE)
+  {
+    panic("access at address = " FMT_PADDR " with len = %d outside pmem crosses a page at pc = " FMT_WORD,
+          addr, len, cpu.pc);
+  }
+  // a page which a device allows to access directly stays mapped
+  if (MUXDEF(CONFIG_DEVICE, mmio_alias(page, guard_base + page), false))
+  {
+    scratch_size = 0;
+    return;
+  }
+  scratch_size = PAGE_SIZE;
+  void *p = mmap(guard_base + page, scratch_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map the page at " FMT_PADDR, page);
+  if (fault_len > 0)
+  {
+    host_write(guard_base + addr, len, paddr_read_slow(addr, len));
+  }
+}
+
+void pmem_guard_end()
+{
+  if (scratch_size == 0)
+    return;
+  paddr_t addr = fault_addr;
+  paddr_t page = addr & ~(paddr_t)PAGE_MASK;
+  if (fault_len < 0)
+  {
+    paddr_write_slow(addr, -fault_len, host_read(guard_base + addr, -fault_len));
+  }
+  mmap(guard_base + page, scratch_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  scratch_size = 0;
+}
+#else
+word_t paddr_read(paddr_t addr, int len)
+{
+  if (likely(in_pmem(addr)))
+    return pmem_read(addr, len);
+  return paddr_read_slow(addr, len);
+}
+
 void paddr_write(paddr_t addr, int len, word_t data)
 {
   if (likely(in_pmem(addr)))
   {
+    pmem_code_check(addr, len);
     pmem_write(addr, len, data);
     return;
   }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
-  out_of_bound(addr);
+  paddr_write_slow(addr, len, data);
 }
+#endif
@@ -14,16 +14,94 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/icache.h>
+#include <cpu/block.h>
+
+#define NR_TLB 1024 // entries for each type of access
+
+// An entry maps a virtual page to the host address of its physical page.
+// Pages outside pmem, e.g. MMIO, are not cached and always walked.
+typedef struct {
+  vaddr_t vpn;
+  uint8_t *host; // NULL means the entry is invalid
+} TLBEntry;
+
+// one TLB for each of MEM_TYPE_IFETCH, MEM_TYPE_READ and MEM_TYPE_WRITE,
+// since the permission of each type is checked when an entry is filled
+static TLBEntry tlb[3][NR_TLB] = {};
+
+#define TLB_IDX(vaddr) (((vaddr) >> PAGE_SHIFT) & (NR_TLB - 1))
+
+/* Drop all translation results. The caches of decoded instructions are
+ * indexed by virtual address, so they are dropped, too. They are never
+ * filled while translation is enabled, therefore a store hitting the TLB
+ * does not need to invalidate them.
+ */
+void tlb_flush() {
+  memset(tlb, 0, sizeof(tlb));
+  IFDEF(CONFIG_ICACHE, icache_flush());
+  IFDEF(CONFIG_BLOCK_CACHE, block_flush());
+}
+
+static inline uint8_t* tlb_lookup(vaddr_t addr, int type) {
+  TLBEntry *e = &tlb[type][TLB_IDX(addr)];
+  return (likely(e->host != NULL && e->vpn == addr >> PAGE_SHIFT) ? e->host + (addr & PAGE_MASK) : NULL);
+}
+
+static paddr_t tlb_fill(vaddr_t addr, int len, int type) {
+  paddr_t ret = isa_mmu_translate(addr, len, type);
+  if (unlikely((ret & PAGE_MASK) != MEM_RET_OK)) {
+    panic("page fault at vaddr = " FMT_WORD " (type = %d) at pc = " FMT_WORD, addr, type, cpu.pc);
+  }
+  paddr_t page = ret & ~(paddr_t)PAGE_MASK;
+  if (in_pmem(page)) {
+    tlb[type][TLB_IDX(addr)] = (TLBEntry) { .vpn = addr >> PAGE_SHIFT, .host = guest_to_host(page) };
+  }
+  return page | (addr & PAGE_MASK);
+}
+
+static word_t translate_read(vaddr_t addr, int len, int type) {
+  if (unlikely((addr & PAGE_MASK) + len > PAGE_SIZE)) {
+    // split an access crossing the page boundary into bytes
+    word_t ret = 0;
+    int i;
+    for (i = 0; i < len; i ++) {
+      ret |= translate_read(addr + i, 1, type) << (i * 8);
+    }
+    return ret;
+  }
+  uint8_t *p = tlb_lookup(addr, type);
+  if (likely(p != NULL)) return host_read(p, len);
+  return paddr_read(tlb_fill(addr, len, type), len);
+}
+
+static void translate_write(vaddr_t addr, int len, word_t data) {
+  if (unlikely((addr & PAGE_MASK) + len > PAGE_SIZE)) {
+    int i;
+    for (i = 0; i < len; i ++) {
+      translate_write(addr + i, 1, data >> (i * 8));
+    }
+    return;
+  }
+  uint8_t *p = tlb_lookup(addr, MEM_TYPE_WRITE);
+  if (likely(p != NULL)) { host_write(p, len, data); return; }
+  paddr_write(tlb_fill(addr, len, MEM_TYPE_WRITE), len, data);
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (isa_mmu_check(addr, len, MEM_TYPE_IFETCH) == MMU_DIRECT) return paddr_read(addr, len);
+  return translate_read(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT) return paddr_read(addr, len);
+  return translate_read(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  if (isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT) { paddr_write(addr, len, data); return; }
+  translate_write(addr, len, data);
 }
@@ -17,8 +17,14 @@
 #include <memory/paddr.h>
 
 void init_rand();
+void init_btrace(const char *file);
+void init_profile(const char *file);
+void init_ftrace(const char *file);
+void init_inst_stat(const char *file);
+void init_simpoint(const char *bbv_file, const char *simpoints_file);
 void init_log(const char *log_file);
 void init_mem();
+void init_icache();
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
@@ -42,10 +48,121 @@ static void welcome() {
 void sdb_set_batch_mode();
 
 static char *log_file = NULL;
+static char *btrace_file = NULL;
+static char *ftrace_file = NULL;
+static char *profile_file = NULL;
+static char *elf_file = NULL;
+static char *inst_stat_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *restore_file = NULL;
+static char *bbv_file = NULL;
+static char *simpoints_file = NULL;
 static int difftest_port = 1234;
 
+#ifdef CONFIG_IMG_MMAP
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <memory/vaddr.h>
+
+static void read_file(int fd, off_t offset, void *buf, size_t len) {
+  while (len > 0) {
+    ssize_t ret = pread(fd, buf, len, offset);
+    Assert(ret > 0, "Can not read '%s' at offset %ld", img_file, (long)offset);
+    buf = (uint8_t *)buf + ret; offset += ret; len -= ret;
+  }
+}
+
+/* Place [offset, offset + len) of the image at `addr`. The whole pages are
+ * mapped privately from the file, and the partial pages at both ends are
+ * copied. If `offset` and `addr` are not aligned to each other, everything
+ * is copied.
+ */
+static void load_segment(int fd, off_t offset, paddr_t addr, size_t len) {
+  if (len == 0) return;
+  Assert(in_pmem(addr) && in_pmem(addr + len - 1),
+      "Segment [" FMT_PADDR ", " FMT_PADDR "] of '%s' is out of pmem", addr, (paddr_t)(addr + len - 1), img_file);
+  uint8_t *host = guest_to_host(addr);
+  size_t head = (PAGE_SIZE - ((uintptr_t)host & PAGE_MASK)) & PAGE_MASK;
+  size_t body = 0;
+  if (head < len && ((offset + head) & PAGE_MASK) == 0) {
+    body = (len - head) & ~PAGE_MASK;
+  }
+  if (body == 0) head = len;
+
+  // the mapping below must not be overwritten by a lazy initialization later
+  pmem_touch(addr, len);
+  read_file(fd, offset, host, head);
+  if (body > 0) {
+    void *p = mmap(host + head, body, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + head);
+    Assert(p != MAP_FAILED, "Can not map '%s'", img_file);
+  }
+  read_file(fd, offset + head + body, host + head + body, len - head - body);
+}
+
+// Load the PT_LOAD segments to their physical addresses, return the size
+// from RESET_VECTOR to the end of the last segment.
+static long load_elf(int fd) {
+  union { Elf32_Ehdr e32; Elf64_Ehdr e64; } eh;
+  read_file(fd, 0, &eh, sizeof(eh));
+  bool is64 = (eh.e64.e_ident[EI_CLASS] == ELFCLASS64);
+  uint64_t entry = (is64 ? eh.e64.e_entry : eh.e32.e_entry);
+  uint64_t phoff = (is64 ? eh.e64.e_phoff : eh.e32.e_phoff);
+  int phnum = (is64 ? eh.e64.e_phnum : eh.e32.e_phnum);
+  int phentsize = (is64 ? eh.e64.e_phentsize : eh.e32.e_phentsize);
+
+  paddr_t end = RESET_VECTOR;
+  int i;
+  for (i = 0; i < phnum; i ++) {
+    union { Elf32_Phdr p32; Elf64_Phdr p64; } u;
+    read_file(fd, phoff + i * phentsize, &u, (is64 ? sizeof(u.p64) : sizeof(u.p32)));
+    Elf64_Phdr ph = u.p64;
+    if (!is64) {
+      ph = (Elf64_Phdr) { .p_type = u.p32.p_type, .p_offset = u.p32.p_offset, .p_paddr = u.p32.p_paddr,
+        .p_filesz = u.p32.p_filesz, .p_memsz = u.p32.p_memsz };
+    }
+    if (ph.p_type != PT_LOAD || ph.p_memsz == 0) continue;
+
+    load_segment(fd, ph.p_offset, ph.p_paddr, ph.p_filesz);
+    if (ph.p_memsz > ph.p_filesz) {
+      paddr_t bss = ph.p_paddr + ph.p_filesz;
+      Assert(in_pmem(bss) && in_pmem(ph.p_paddr + ph.p_memsz - 1), "Segment of '%s' is out of pmem", img_file);
+      memset(guest_to_host(bss), 0, ph.p_memsz - ph.p_filesz);
+    }
+    Log("Load segment [" FMT_PADDR ", " FMT_PADDR ")", (paddr_t)ph.p_paddr, (paddr_t)(ph.p_paddr + ph.p_memsz));
+    if (ph.p_paddr + ph.p_memsz > end) end = ph.p_paddr + ph.p_memsz;
+  }
+
+  cpu.pc = entry;
+  return end - RESET_VECTOR;
+}
+
+static long load_img() {
+  if (img_file == NULL) {
+    Log("No image is given. Use the default build-in image.");
+    return 4096; // built-in image size
+  }
+
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+  long size = lseek(fd, 0, SEEK_END);
+
+  char magic[SELFMAG] = {};
+  if (size >= sizeof(Elf64_Ehdr) && pread(fd, magic, SELFMAG, 0) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+    Log("The image is %s, an ELF file", img_file);
+    size = load_elf(fd);
+  } else {
+    Log("The image is %s, size = %ld", img_file, size);
+    load_segment(fd, 0, RESET_VECTOR, size);
+  }
+
+  // the mappings stay after the file is closed
+  close(fd);
+  return size;
+}
+#else
 static long load_img() {
   if (img_file == NULL) {
     Log("No image is given. Use the default build-in image.");
@@ -61,36 +178,72 @@ static long load_img() {
   Log("The image is %s, size = %ld", img_file, size);
 
   fseek(fp, 0, SEEK_SET);
+  pmem_touch(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
 
   fclose(fp);
   return size;
 }
+#endif
+
+static long restore_checkpoint() {
+#ifdef CONFIG_CHECKPOINT
+  checkpoint_restore(restore_file);
+  // all of pmem may be in use
+  return CONFIG_MSIZE - CONFIG_PC_RESET_OFFSET;
+#else
+  panic("Checkpoints are not supported, enable CHECKPOINT in menuconfig");
+#endif
+}
 
 static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
     {"batch"    , no_argument      , NULL, 'b'},
     {"log"      , required_argument, NULL, 'l'},
+    {"btrace"   , required_argument, NULL, 't'},
+    {"ftrace"   , required_argument, NULL, 'f'},
+    {"profile"  , required_argument, NULL, 'P'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"inst-stat", required_argument, NULL, 'S'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"restore"  , required_argument, NULL, 'r'},
+    {"bbv"      , required_argument, NULL, 'B'},
+    {"simpoints", required_argument, NULL, 'k'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:t:f:P:e:S:d:p:r:B:k:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
+      case 't': btrace_file = optarg; break;
+      case 'f': ftrace_file = optarg; break;
+      case 'P': profile_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+      case 'S': inst_stat_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'r': restore_file = optarg; break;
+      case 'B': bbv_file = optarg; break;
+      case 'k': simpoints_file = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
+        printf("\t-t,--btrace=FILE        write binary instruction trace to FILE\n");
+        printf("\t-f,--ftrace=FILE        write function call trace to FILE, and costs to FILE.funcs\n");
+        printf("\t-P,--profile=FILE       write execution profile to FILE.folded and FILE.pb\n");
+        printf("\t-e,--elf=FILE           read symbols from FILE, default to IMAGE if it is ELF\n");
+        printf("\t-S,--inst-stat=FILE     write instruction counts to FILE as CSV or JSON\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-r,--restore=FILE       start from checkpoint FILE instead of IMAGE\n");
+        printf("\t-B,--bbv=FILE           write basic block vectors to FILE for SimPoint\n");
+        printf("\t-k,--simpoints=FILE     save checkpoints at the intervals listed in FILE\n");
         printf("\n");
         exit(0);
     }
@@ -110,17 +263,39 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Map the binary instruction trace. */
+  IFDEF(CONFIG_BTRACE, init_btrace(btrace_file));
+
+  /* Prepare the execution profile. */
+  IFDEF(CONFIG_PROFILE, init_profile(profile_file));
+
+  /* Prepare the instruction statistics. */
+  IFDEF(CONFIG_INST_STAT, init_inst_stat(inst_stat_file));
+
   /* Initialize memory. */
   init_mem();
 
+  /* Initialize the decoded instruction cache. */
+  IFDEF(CONFIG_ICACHE, init_icache());
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
   /* Perform ISA dependent initialization. */
   init_isa();
 
-  /* Load the image to memory. This will overwrite the built-in image. */
-  long img_size = load_img();
+  /* Load the image to memory, or restore the whole machine from a
+   * checkpoint. This will overwrite the built-in image. */
+  long img_size = (restore_file != NULL ? restore_checkpoint() : load_img());
+
+  /* Read the symbols of the guest program. */
+  init_symbol(elf_file != NULL ? elf_file : img_file);
+
+  /* Start tracing function calls from the entry of the guest. */
+  IFDEF(CONFIG_FTRACE, init_ftrace(ftrace_file));
+
+  /* Start counting the intervals for SimPoint. */
+  IFDEF(CONFIG_SIMPOINT, init_simpoint(bbv_file, simpoints_file));
 
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
@@ -128,12 +303,14 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize the simple debugger. */
   init_sdb();
 
-  IFDEF(CONFIG_ITRACE, init_disasm(
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IRINGBUF)
+  init_disasm(
     MUXDEF(CONFIG_ISA_x86,     "i686",
     MUXDEF(CONFIG_ISA_mips32,  "mipsel",
     MUXDEF(CONFIG_ISA_riscv32, "riscv32",
     MUXDEF(CONFIG_ISA_riscv64, "riscv64", "bad")))) "-pc-linux-gnu"
-  ));
+  );
+#endif
 
   /* Display welcome message. */
   welcome();
@@ -150,6 +327,7 @@ static long load_img() {
 void am_init_monitor() {
   init_rand();
   init_mem();
+  IFDEF(CONFIG_ICACHE, init_icache());
   init_isa();
   load_img();
   IFDEF(CONFIG_DEVICE, init_device());
@@ -0,0 +1,145 @@
+#include "sdb.h"
+#include <cpu/breakpoint.h>
+#include <cpu/block.h>
+#include <ctype.h>
+
+#define NR_BP 64
+
+typedef struct breakpoint
+{
+  int NO; // -1 if unused
+  vaddr_t addr;
+  uint64_t hit;
+} BP;
+
+static BP bp_pool[NR_BP];
+static int nr_bp = 0, next_no = 0;
+uint8_t bp_filter[BP_FILTER_SIZE] = {};
+
+void init_bp_pool()
+{
+  for (int i = 0; i < NR_BP; i++)
+  {
+    bp_pool[i].NO = -1;
+  }
+}
+
+bool bp_active()
+{
+  return nr_bp > 0;
+}
+
+static BP *bp_find(vaddr_t addr)
+{
+  for (int i = 0; i < NR_BP; i++)
+  {
+    if (bp_pool[i].NO >= 0 && bp_pool[i].addr == addr)
+      return &bp_pool[i];
+  }
+  return NULL;
+}
+
+static void print_loc(vaddr_t addr)
+{
+  vaddr_t start;
+  const char *name = symbol_lookup(addr, &start);
+  printf(FMT_WORD, addr);
+  if (name != NULL && addr == start)
+    printf(" <%s>", name);
+  else if (name != NULL)
+    printf(" <%s+%d>", name, (int)(addr - start));
+}
+
+bool bp_stop(vaddr_t pc)
+{
+  BP *bp = bp_find(pc);
+  if (bp == NULL)
+    return false;
+  bp->hit++;
+  printf("\nBreakpoint %d, ", bp->NO);
+  print_loc(pc);
+  printf("\n");
+  if (nemu_state.state == NEMU_RUNNING)
+    nemu_state.state = NEMU_STOP;
+  return true;
+}
+
+// ADDR is an expression, SYMBOL is the name of a function
+static bool parse_loc(char *args, vaddr_t *addr)
+{
+  if (isalpha((unsigned char)args[0]) || args[0] == '_' || args[0] == '.')
+  {
+    if (symbol_addr(args, addr))
+      return true;
+    printf("no function named %s\n", args);
+    return false;
+  }
+  bool success = true;
+  *addr = expr(args, &success);
+  return success;
+}
+
+void setbp(char *args)
+{
+  vaddr_t addr;
+  if (!parse_loc(args, &addr))
+    return;
+  BP *bp = bp_find(addr);
+  if (bp != NULL)
+  {
+    printf("Breakpoint %d is already at " FMT_WORD "\n", bp->NO, addr);
+    return;
+  }
+  for (bp = bp_pool; bp < bp_pool + NR_BP && bp->NO >= 0; bp++)
+    ;
+  if (bp == bp_pool + NR_BP)
+  {
+    printf("too many breakpoints\n");
+    return;
+  }
+  *bp = (BP){.NO = next_no++, .addr = addr, .hit = 0};
+  nr_bp++;
+  bp_filter[BP_FILTER_IDX(addr)]++;
+  // a cached block only stops at its end, so the one running over
+  // the breakpoint is dropped, and will be recorded to end before it
+  IFDEF(CONFIG_BLOCK_CACHE, block_invalidate(addr, 4));
+  printf("Breakpoint %d at ", bp->NO);
+  print_loc(addr);
+  printf("\n");
+}
+
+void clearbp(char *args)
+{
+  vaddr_t addr;
+  if (!parse_loc(args, &addr))
+    return;
+  BP *bp = bp_find(addr);
+  if (bp == NULL)
+  {
+    printf("No breakpoint at " FMT_WORD "\n", addr);
+    return;
+  }
+  printf("Deleted breakpoint %d\n", bp->NO);
+  bp->NO = -1;
+  nr_bp--;
+  bp_filter[BP_FILTER_IDX(addr)]--;
+}
+
+void displayBp()
+{
+  if (nr_bp == 0)
+  {
+    printf("No breakpoints.\n");
+    return;
+  }
+  printf("Num\taddress\t\thits\n");
+  for (int i = 0; i < NR_BP; i++)
+  {
+    BP *bp = &bp_pool[i];
+    if (bp->NO < 0)
+      continue;
+    printf("%d\t", bp->NO);
+    print_loc(bp->addr);
+    printf("\t%" PRIu64 "\n", bp->hit);
+  }
+}
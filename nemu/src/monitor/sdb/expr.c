@@ -14,14 +14,11 @@
  ***************************************************************************************/
 
 #include <isa.h>
-
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
- */
-#include <regex.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include "message.h"
+#include "sdb.h"
 #include <memory/paddr.h>
 enum
 {
@@ -36,158 +33,104 @@ enum
 
 };
 
-static struct rule
-{
-  const char *regex;
-  int token_type;
-} rules[] = {
-
-    /* TODO: Add more rules.
-     * Pay attention to the precedence level of different rules.
-     */
-
-    {"\\*", '*'},                 // mul,DREF
-    {"/", '/'},                   // division
-    {"\\+", '+'},                 // plus
-    {"-", '-'},                   // minus,subtract
-    {"==", TK_EQ},                // equal
-    {"!=", TK_NEQ},               //!=
-    {"&&", AND},                  // and
-    {"0[xX][0-9a-f]{1,8}", 'h'},  // hexadecimal
-    {"[$][a-z]{1,2}[0-9]*", REG}, // register
-    {"[0-9]+", 'd'},              // decimal
-    {"\\(", '('},                 //(
-    {"\\)", ')'},                 //)
-    {" +", TK_NOTYPE},            // spaces
-};
-
-#define NR_REGEX ARRLEN(rules)
-
-static regex_t re[NR_REGEX] = {};
-
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex()
-{
-  int i;
-  char error_msg[128];
-  int ret;
-
-  for (i = 0; i < NR_REGEX; i++)
-  {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0)
-    {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
-    }
-  }
-}
-
 typedef struct token
 {
   int type;
-  char str[32];
+  const char *str; // points into the expression
+  int len;
 } Token;
 
-static Token tokens[8192] __attribute__((used)) = {};
-static int nr_token __attribute__((used)) = 0;
+static Token *tokens = NULL;
+static int nr_token = 0, max_token = 0;
 
-static bool make_token(char *e)
+// whether a '*' or '-' at this point is a unary operator
+static bool unary_here()
 {
-  int position = 0;
-  int i;
-  regmatch_t pmatch;
+  if (nr_token == 0)
+    return true;
+  int type = tokens[nr_token - 1].type;
+  return type != ')' && type != REG && type != 'h' && type != 'd';
+}
 
+/* Split `e` into tokens in a single pass, looking at the first one or
+ * two characters to decide the type of a token.
+ */
+static bool make_token(const char *e)
+{
+  const char *s = e, *start = e;
   nr_token = 0;
 
-  while (e[position] != '\0')
+  while (*s != '\0')
   {
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i++)
+    int type;
+    start = s;
+    if (isspace((unsigned char)*s))
+    {
+      s++;
+      continue;
+    }
+    switch (*s)
     {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0)
+    case '+':
+    case '/':
+    case '(':
+    case ')':
+      type = *s++;
+      break;
+    case '*':
+      type = (unary_here() ? DREF : '*');
+      s++;
+      break;
+    case '-':
+      type = (unary_here() ? MINUS : '-');
+      s++;
+      break;
+    case '=':
+    case '!':
+    case '&':
+      if (s[1] != (*s == '&' ? '&' : '='))
+        goto bad;
+      type = (*s == '=' ? TK_EQ : (*s == '!' ? TK_NEQ : AND));
+      s += 2;
+      break;
+    case '$':
+      for (s++; isalnum((unsigned char)*s) || *s == '$'; s++)
+        ;
+      if (s - start == 1)
+        goto bad;
+      type = REG;
+      break;
+    default:
+      if (!isdigit((unsigned char)*s))
+        goto bad;
+      if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && isxdigit((unsigned char)s[2]))
       {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
-
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
-
-        position += substr_len;
-
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
-
-        switch (rules[i].token_type)
-        {
-        case TK_NOTYPE:;
-          break; // ignore spaces
-        case '*':
-        {
-          // assert(substr_len <= 32);
-          if (nr_token == 0 || (tokens[nr_token - 1].type != ')' && tokens[nr_token - 1].type != REG && tokens[nr_token - 1].type != 'h' && tokens[nr_token - 1].type != 'd'))
-          {
-            tokens[nr_token].type = DREF;
-          }
-          else
-          {
-            tokens[nr_token].type = '*';
-          }
-          memcpy(tokens[nr_token].str, substr_start, substr_len); // record str to tokens.str
-          nr_token++;
-        }
-        break;
-        case '-':
-        {
-          if (nr_token == 0 || (tokens[nr_token - 1].type != ')' && tokens[nr_token - 1].type != REG && tokens[nr_token - 1].type != 'h' && tokens[nr_token - 1].type != 'd'))
-          {
-            tokens[nr_token].type = MINUS; // minus,-a
-          }
-          else
-          {
-            tokens[nr_token].type = '-'; // subtract,a-b
-          }
-          memcpy(tokens[nr_token].str, substr_start, substr_len); // record str to tokens.str
-          nr_token++;
-        }
-        break;
-        case '+':
-        case '/':
-        case '(':
-        case ')':
-        case 'd':
-        case 'h':
-        case AND:
-        case TK_NEQ:
-        case TK_EQ:
-        case REG:
-        {
-          // assert(substr_len <= 32);
-          tokens[nr_token].type = rules[i].token_type;
-          memcpy(tokens[nr_token].str, substr_start, substr_len); // record str to tokens.str
-          nr_token++;
-        }
-        break;
-        default:
-          assert(0);
-          break;
-        }
-        break;
+        for (s += 2; isxdigit((unsigned char)*s); s++)
+          ;
+        type = 'h';
       }
+      else
+      {
+        for (; isdigit((unsigned char)*s); s++)
+          ;
+        type = 'd';
+      }
+      break;
     }
 
-    if (i == NR_REGEX)
+    if (nr_token == max_token)
     {
-      printf("no match at position %d\n%s\n%*.s^\n", position, e, position, "");
-      return false;
+      max_token = (max_token == 0 ? 64 : max_token * 2);
+      tokens = realloc(tokens, sizeof(Token) * max_token);
+      assert(tokens);
     }
+    tokens[nr_token++] = (Token){.type = type, .str = start, .len = s - start};
   }
-
   return true;
+
+bad:
+  printf("no match at position %d\n%s\n%*.s^\n", (int)(start - e), e, (int)(start - e), "");
+  return false;
 }
 bool check_match(int p, int q)
 {
@@ -216,231 +159,345 @@ bool check_parentheses(int p, int q)
   }
   return false;
 }
-#define MAXPRIORITY (10)
-
-static const int OFFSET = 10;
-
 static int get_priority(int op)
 {
   switch (op)
   {
-  case MINUS:
-    return MAXPRIORITY - (OFFSET - 5);
-  case DREF:
-    return MAXPRIORITY - (OFFSET - 4);
   case '*':
   case '/':
-    return MAXPRIORITY - (OFFSET - 3);
+    return 3;
   case '+':
   case '-':
-    return MAXPRIORITY - (OFFSET - 2);
+    return 2;
   case TK_EQ:
   case TK_NEQ:
-    return MAXPRIORITY - (OFFSET - 1);
+    return 1;
   case AND:
-    return MAXPRIORITY - OFFSET;
+    return 0;
   default:
-    assert(0);
+    return -1; // not a binary operator
   }
 }
-word_t eval(int p, int q, bool *success)
+
+enum
 {
+  OP_IMM,
+  OP_REG,
+  OP_DREF,
+  OP_MINUS,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EQ,
+  OP_NEQ,
+  OP_AND,
+};
 
-#if 0
-  printf("eval:  ");
-  for (int i = p; i <= q; i++)
+static void emit(ExprCode *c, int op, int reg, word_t imm)
+{
+  c->code[c->len++] = (ExprInst){.op = op, .reg = reg, .imm = imm};
+}
+
+static int bind_reg(ExprCode *c, const word_t *r)
+{
+  int i;
+  for (i = 0; i < c->nr_reg; i++)
   {
-    printf("%s", tokens[i].str);
+    if (c->reg[i] == r)
+      return i;
   }
-  printf("\n");
-#endif
+  c->reg = realloc(c->reg, sizeof(c->reg[0]) * (c->nr_reg + 1));
+  assert(c->reg);
+  c->reg[c->nr_reg] = r;
+  return c->nr_reg++;
+}
 
+/* Emit the postfix code of tokens[p..q]. The main operator is the binary
+ * operator outside parentheses with the lowest priority, the rightmost
+ * one among equals. Without such an operator, the expression is a unary
+ * operator applied to the rest, a parenthesized expression, or a leaf.
+ */
+static bool compile(int p, int q, ExprCode *c)
+{
   if (p > q)
+    return false;
+  if (p == q)
   {
-    *success = false;
-#ifdef DEBUG
-    printf("p > q, p = %d,q = %d\n", p, q);
-#endif
-  }
-  else if (p == q && success)
-  {
-    /* Single token.
-     * For now this token should be a number.
-     * Return the value of the number.
-     */
+    switch (tokens[p].type)
     {
-      switch (tokens[p].type)
-      {
-      case 'd': // decimal
-      {
-        if (tokens[p].str[0] == '0')
-          return 0;
-        word_t num = atoi(tokens[p].str);
-        if (num == 0)
-        {
-          *success = false;
-          printf("convert to num error: %s\n", tokens[p].str);
-        }
-        return num;
-      };
-      break;
-      case 'h': // hexadecimal
-      {
-        assert(strlen(tokens[p].str) >= 3);
-        word_t num;
-        if (tokens[p].str[2] == '0')
-          return 0;
-        if (sscanf(tokens[p].str, "%x", &num) == EOF)
-        {
-          *success = false;
-          printf("convert to num error: %s\n", tokens[p].str);
-        }
-        return num;
-      }
-      break;
-      case REG: // register
+    case 'd':
+      emit(c, OP_IMM, 0, strtoull(tokens[p].str, NULL, 10));
+      return true;
+    case 'h':
+      emit(c, OP_IMM, 0, strtoull(tokens[p].str, NULL, 16));
+      return true;
+    case REG:
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "%.*s", tokens[p].len - 1, tokens[p].str + 1);
+      const word_t *r = isa_reg_str2ptr(name);
+      if (r == NULL)
       {
-        word_t num = isa_reg_str2val(tokens[p].str + 1, success);
-        return num;
-      }
-      break;
-      default:
-        *success = false;
-        break;
+        printf("unknown register %.*s\n", tokens[p].len, tokens[p].str);
+        return false;
       }
+      emit(c, OP_REG, bind_reg(c, r), 0);
+      return true;
     }
+    default:
+      return false;
+    }
+  }
+  if (check_parentheses(p, q))
+    return compile(p + 1, q - 1, c);
+
+  int pos = -1, min_priority = 0, in_bracket = 0;
+  for (int i = p; i <= q; i++)
+  {
+    int type = tokens[i].type;
+    if (type == '(')
+      in_bracket++;
+    else if (type == ')')
+      in_bracket--;
+    else if (in_bracket == 0 && get_priority(type) >= 0 && (pos < 0 || get_priority(type) <= min_priority))
+    {
+      min_priority = get_priority(type);
+      pos = i;
+    }
+  }
+
+  if (pos < 0)
+  {
+    int type = tokens[p].type;
+    if (type != DREF && type != MINUS)
+      return false;
+    if (!compile(p + 1, q, c))
+      return false;
+    if (type == DREF)
+      c->nr_load++;
+    emit(c, (type == DREF ? OP_DREF : OP_MINUS), 0, 0);
+    return true;
   }
-  else if (check_parentheses(p, q) && success)
+
+  if (!compile(p, pos - 1, c) || !compile(pos + 1, q, c))
+    return false;
+  switch (tokens[pos].type)
+  {
+  case '+':
+    emit(c, OP_ADD, 0, 0);
+    break;
+  case '-':
+    emit(c, OP_SUB, 0, 0);
+    break;
+  case '*':
+    emit(c, OP_MUL, 0, 0);
+    break;
+  case '/':
+    emit(c, OP_DIV, 0, 0);
+    break;
+  case TK_EQ:
+    emit(c, OP_EQ, 0, 0);
+    break;
+  case TK_NEQ:
+    emit(c, OP_NEQ, 0, 0);
+    break;
+  case AND:
+    emit(c, OP_AND, 0, 0);
+    break;
+  }
+  return true;
+}
+
+bool expr_compile(const char *e, ExprCode *c)
+{
+  *c = (ExprCode){};
+  if (!make_token(e))
+    return false;
+  if (check_match(0, nr_token - 1) == false)
+  {
+    printMessage(BRACKET, NULL);
+    return false;
+  }
+  // each token emits at most one instruction
+  c->code = malloc(sizeof(ExprInst) * (nr_token > 0 ? nr_token : 1));
+  assert(c->code);
+  if (!compile(0, nr_token - 1, c))
   {
-    /* The expression is surrounded by a matched pair of parentheses.
-     * If that is the case, just throw away the parentheses.
-     */
-    return eval(p + 1, q - 1, success);
+    expr_free(c);
+    return false;
   }
-  else if (success)
+  return true;
+}
+
+word_t expr_run(const ExprCode *c, paddr_t *load, int *nr_load, bool *success)
+{
+  word_t stack[c->len];
+  int sp = 0;
+#define TOP stack[sp - 1]
+  *success = true;
+  if (nr_load != NULL)
+    *nr_load = 0;
+  for (int i = 0; i < c->len; i++)
   {
-    /*
-    找主运算符
-    1.非运算符的token不是主运算符.
-    2.出现在一对括号中的token不是主运算符. 注意到这里不会出现有括号包围整个表达式的情况, 因为这种情况已经在check_parentheses()相应的if块中被处理了.
-    3.主运算符的优先级在表达式中是最低的. 这是因为主运算符是最后一步才进行的运算符.
-    4.当有多个运算符的优先级都是最低时, 根据结合性, 最后被结合的运算符才是主运算符. 一个例子是1 + 2 + 3, 它的主运算符应该是右边的+.
-    */
-    int pos = p;
-    int min_priority = MAXPRIORITY;
-    int in_bracket = 0;
-    for (int i = p; i <= q; ++i)
+    const ExprInst *inst = &c->code[i];
+    word_t val2 = 0;
+    if (inst->op >= OP_ADD)
+      val2 = stack[--sp];
+    switch (inst->op)
     {
-      switch (tokens[i].type)
-      {
-      case '*':
-      case '/':
-      case '+':
-      case '-':
-      case TK_EQ:
-      case TK_NEQ:
-      case AND:
-      case DREF:
-      case MINUS:
-      {
-        if (in_bracket == 0 && get_priority(tokens[i].type) <= min_priority)
-        {
-          min_priority = get_priority(tokens[i].type);
-          pos = i;
-        }
-      };
+    case OP_IMM:
+      stack[sp++] = inst->imm;
+      break;
+    case OP_REG:
+      stack[sp++] = *c->reg[inst->reg];
       break;
-      case '(':
-        in_bracket++;
-        break;
-      case ')':
-        in_bracket--;
-        break;
-      case 'd':
-      case 'h':
-      case REG:
-        break;
-      default:
-        assert(0);
-        break;
+    case OP_DREF:
+      if (!in_pmem(TOP) || !in_pmem(TOP + 3))
+      {
+        printf("address " FMT_WORD " is out of bound of pmem\n", TOP);
+        *success = false;
+        return 0;
       }
-    }
-
-    if (tokens[pos].type == DREF)
-    {
-      word_t addr = eval(p + 1, q, success);
-      return getnum(addr);
-    }
-    else if (tokens[pos].type == MINUS)
-    {
-      word_t val = eval(p + 1, q, success);
-      return -val;
-    }
-    else
-    {
-      word_t val1 = eval(p, pos - 1, success);
-      word_t val2 = eval(pos + 1, q, success);
-
-#if 0
-    printf("%u %s %u\n", val1, tokens[pos].str, val2);
-#endif
-      switch (tokens[pos].type)
+      if (load != NULL)
+        load[(*nr_load)++] = TOP;
+      TOP = getnum(TOP);
+      break;
+    case OP_MINUS:
+      TOP = -TOP;
+      break;
+    case OP_ADD:
+      TOP += val2;
+      break;
+    case OP_SUB:
+      TOP -= val2;
+      break;
+    case OP_MUL:
+      TOP *= val2;
+      break;
+    case OP_DIV:
+      if (val2 == 0)
       {
-      case '+':
-        return val1 + val2;
-      case '-':
-        return val1 - val2;
-      case '*':
-        return val1 * val2;
-      case '/':
-        assert(val2 != 0);
-        return val1 / val2;
-      case TK_EQ:
-        return val1 == val2;
-      case TK_NEQ:
-        return val1 != val2;
-      case AND:
-        return val1 && val2;
-      default:
-        assert(0);
-        break;
+        printf("division by zero\n");
+        *success = false;
+        return 0;
       }
+      TOP /= val2;
+      break;
+    case OP_EQ:
+      TOP = (TOP == val2);
+      break;
+    case OP_NEQ:
+      TOP = (TOP != val2);
+      break;
+    case OP_AND:
+      TOP = (TOP && val2);
+      break;
     }
   }
-  return 0;
+#undef TOP
+  return stack[0];
 }
 
-static void init()
+void expr_free(ExprCode *c)
 {
-  nr_token = 0;
-  memset(tokens, 0, sizeof(tokens));
+  free(c->code);
+  free(c->reg);
+  *c = (ExprCode){};
 }
 
-word_t expr(char *e, bool *success)
+/* Recently compiled expressions, looked up by their text, so that `p`,
+ * `x` and scripts evaluating the same expressions again skip lexing and
+ * parsing. The least recently used one is dropped when the cache is full.
+ */
+#define EXPR_CACHE_SIZE 256
+#define EXPR_CACHE_BUCKET (EXPR_CACHE_SIZE * 2)
+
+typedef struct CacheEntry
 {
-  init();
-  if (!make_token(e))
+  char *text;
+  uint32_t hash;
+  ExprCode code;
+  struct CacheEntry *prev, *next; // LRU list, the most recent one first
+  struct CacheEntry *hnext;       // chain of the bucket
+} CacheEntry;
+
+static CacheEntry cache[EXPR_CACHE_SIZE];
+static CacheEntry *bucket[EXPR_CACHE_BUCKET];
+static CacheEntry *lru_head = NULL, *lru_tail = NULL;
+
+static uint32_t text_hash(const char *e)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  for (; *e != '\0'; e++)
+    h = (h ^ (uint8_t)*e) * 16777619u;
+  return h;
+}
+
+static void lru_unlink(CacheEntry *c)
+{
+  *(c->prev ? &c->prev->next : &lru_head) = c->next;
+  *(c->next ? &c->next->prev : &lru_tail) = c->prev;
+}
+
+static void lru_push(CacheEntry *c)
+{
+  c->prev = NULL;
+  c->next = lru_head;
+  *(lru_head ? &lru_head->prev : &lru_tail) = c;
+  lru_head = c;
+}
+
+static const ExprCode *cache_get(const char *e)
+{
+  uint32_t h = text_hash(e);
+  CacheEntry *c;
+  for (c = bucket[h % EXPR_CACHE_BUCKET]; c != NULL; c = c->hnext)
   {
-    *success = false;
-    return 0;
+    if (c->hash == h && strcmp(c->text, e) == 0)
+    {
+      lru_unlink(c);
+      lru_push(c);
+      return &c->code;
+    }
   }
-  if (check_match(0, nr_token - 1) == false)
+
+  ExprCode code;
+  if (!expr_compile(e, &code))
+    return NULL;
+
+  static int nr_used = 0;
+  if (nr_used < EXPR_CACHE_SIZE)
+    c = &cache[nr_used++];
+  else
   {
-    *success = false;
-    printMessage(BRACKET, NULL);
-    return 0;
+    // evict the least recently used one
+    c = lru_tail;
+    lru_unlink(c);
+    CacheEntry **pp = &bucket[c->hash % EXPR_CACHE_BUCKET];
+    while (*pp != c)
+      pp = &(*pp)->hnext;
+    *pp = c->hnext;
+    free(c->text);
+    expr_free(&c->code);
   }
-/* TODO: Insert codes to evaluate the expression. */
-#if 0
-  printf("nr_token is: %d\n", nr_token);
-  for (int i = 0; i < nr_token; i++)
+  c->text = strdup(e);
+  assert(c->text);
+  c->hash = h;
+  c->code = code;
+  c->hnext = bucket[h % EXPR_CACHE_BUCKET];
+  bucket[h % EXPR_CACHE_BUCKET] = c;
+  lru_push(c);
+  return &c->code;
+}
+
+word_t expr(char *e, bool *success)
+{
+  const ExprCode *c = cache_get(e);
+  if (c == NULL)
   {
-    printf("%c  %d", tokens[i].type, tokens[i].type);
-    if (tokens[i].str != NULL)
-      printf("\t%s\n", tokens[i].str);
+    *success = false;
+    return 0;
   }
-#endif
-  word_t ans = 0;
-  ans = eval(0, nr_token - 1, success);
-  return ans;
-}
\ No newline at end of file
+  return expr_run(c, NULL, NULL, success);
+}
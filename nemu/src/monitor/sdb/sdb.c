@@ -25,11 +25,17 @@
 
 static int is_batch_mode = false;
 
-void init_regex();
 void init_wp_pool();
 void setwp(char *args);
 void displayWp();
 void free_wp(int num);
+void init_bp_pool();
+void setbp(char *args);
+void clearbp(char *args);
+void displayBp();
+void snapshot_take();
+void snapshot_restore(char *args);
+void displaySnapshot();
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char *rl_gets()
 {
@@ -98,6 +104,14 @@ static int cmd_info(char *args)
   {
     displayWp();
   }
+  else if (*args == 'b') // print breakpoint
+  {
+    displayBp();
+  }
+  else if (*args == 's') // print snapshot
+  {
+    displaySnapshot();
+  }
   else // unknown command
   {
     printMessage(Unknown, args);
@@ -226,6 +240,61 @@ static int cmd_w(char *args)
   setwp(args);
   return 0;
 }
+static int cmd_b(char *args)
+{
+  if (get_arg_num(args) != 1)
+  {
+    printMessage(ARG_NUM_WRONG, NULL);
+    return 0;
+  }
+  setbp(args);
+  return 0;
+}
+static int cmd_clear(char *args)
+{
+  if (get_arg_num(args) != 1)
+  {
+    printMessage(ARG_NUM_WRONG, NULL);
+    return 0;
+  }
+  clearbp(args);
+  return 0;
+}
+static int cmd_snapshot(char *args)
+{
+  if (get_arg_num(args) != 0)
+  {
+    printMessage(ARG_NUM_WRONG, NULL);
+    return 0;
+  }
+  snapshot_take();
+  return 0;
+}
+static int cmd_restore(char *args)
+{
+  if (get_arg_num(args) != 1)
+  {
+    printMessage(ARG_NUM_WRONG, NULL);
+    return 0;
+  }
+  snapshot_restore(args);
+  return 0;
+}
+static int cmd_checkpoint(char *args)
+{
+  if (get_arg_num(args) != 1)
+  {
+    printMessage(ARG_NUM_WRONG, NULL);
+    return 0;
+  }
+#ifdef CONFIG_CHECKPOINT
+  if (checkpoint_save(args))
+    printf("Checkpoint saved to %s\n", args);
+#else
+  printf("checkpoints are not supported, enable CHECKPOINT in menuconfig\n");
+#endif
+  return 0;
+}
 static int cmd_help(char *args);
 
 static struct
@@ -239,12 +308,17 @@ static struct
         {"c", "Continue the execution of the program", cmd_c},
         {"q", "Exit NEMU", cmd_q},
         {"si", "step into for n", cmd_si},
-        {"info", "print program state,r:print register; w:print watchpoint", cmd_info},
+        {"info", "print program state,r:print register; w:print watchpoint; b:print breakpoint; s:print snapshot", cmd_info},
         {"x", "scan the memory", cmd_x},
         {"p", "evaluate expression", cmd_p},
         {"test", "test_calculation", cmd_test},
         {"w", "set watchpoint", cmd_w},
         {"d", "delete watchpoint", cmd_d},
+        {"b", "set breakpoint at ADDR or SYMBOL", cmd_b},
+        {"clear", "delete breakpoint at ADDR or SYMBOL", cmd_clear},
+        {"snapshot", "take a snapshot of the machine", cmd_snapshot},
+        {"restore", "restore snapshot N, dropping the later ones", cmd_restore},
+        {"checkpoint", "save the machine to FILE, see --restore", cmd_checkpoint},
         /* TODO: Add more commands */
 };
 
@@ -339,9 +413,9 @@ void sdb_mainloop()
 
 void init_sdb()
 {
-  /* Compile the regular expressions. */
-  init_regex();
-
   /* Initialize the watchpoint pool. */
   init_wp_pool();
+
+  /* Initialize the breakpoint pool. */
+  init_bp_pool();
 }
@@ -20,4 +20,28 @@
 
 word_t expr(char *e, bool *success);
 
+/* An expression compiled into postfix code. The registers it reads are
+ * bound to their storage, and each of its loads is run exactly once per
+ * evaluation, so a watchpoint can tell when it needs to be re-evaluated.
+ */
+typedef struct {
+  uint8_t op;
+  uint8_t reg; // index into `reg` of OP_REG
+  word_t imm;  // value of OP_IMM
+} ExprInst;
+
+typedef struct {
+  ExprInst *code;
+  int len;
+  const word_t **reg; // distinct registers read
+  int nr_reg;
+  int nr_load;
+} ExprCode;
+
+bool expr_compile(const char *e, ExprCode *c);
+/* the addresses loaded from are put into `load` if it is not NULL, and
+ * their number into `nr_load`, which counts those before a failure too */
+word_t expr_run(const ExprCode *c, paddr_t *load, int *nr_load, bool *success);
+void expr_free(ExprCode *c);
+
 #endif
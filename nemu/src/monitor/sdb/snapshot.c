@@ -0,0 +1,207 @@
+#include "sdb.h"
+#include <isa.h>
+#include <cpu/btrace.h>
+#include <cpu/ftrace.h>
+#include <device/map.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* A snapshot is a frozen copy of NEMU made by fork(): the parent keeps the
+ * state at the time of the snapshot and waits, while the child goes on as
+ * the debugging session. Since the pages are copy-on-write, taking or
+ * restoring a snapshot costs about the same no matter how large pmem is.
+ *
+ * The snapshots form a chain of processes. To restore snapshot N, the
+ * session sets `target` to N and exits, the snapshots younger than N exit
+ * in turn, and snapshot N forks a new session. When the session ends for
+ * other reasons, every snapshot exits with its status.
+ *
+ * Everything in the memory of NEMU, including the devices, is copied by
+ * fork(), but the threads and timers are not and are started again in the
+ * new session. The connection to the SDL window is shared by all the
+ * processes, so the display and the sound may not survive a restore.
+ * The files opened by the devices, e.g. the sdcard image, are shared too,
+ * and their offsets are saved and restored along with the devices. The
+ * data written to them by an abandoned session is kept.
+ *
+ * The trace files are not copied either, as they are mapped MAP_SHARED.
+ * A snapshot keeps the number of records in each of them and rewinds it
+ * on restore, so that the trace only has the records of the sessions that
+ * lead to the current one. Records overwritten after the ring wraps around
+ * in an abandoned session are lost.
+ */
+
+#define NR_SNAPSHOT 32
+
+typedef struct snapshot
+{
+  vaddr_t pc;
+  uint64_t nr_inst;
+  uint64_t time;
+} Snapshot;
+
+typedef struct
+{
+  int target; // the snapshot to restore, -1 if none
+} SnapshotCtl;
+
+typedef struct
+{
+  uint64_t btrace, ftrace;
+} TraceCount;
+
+static Snapshot snapshot[NR_SNAPSHOT];
+static int nr_snapshot = 0;
+static SnapshotCtl *ctl = NULL;
+
+extern uint64_t g_nr_guest_inst;
+#ifdef CONFIG_DEVICE
+void init_alarm();
+#endif
+
+static void start_session(int id)
+{
+  log_after_fork();
+  IFDEF(CONFIG_DEVICE, init_alarm());
+  set_time(snapshot[id].time);
+}
+
+static TraceCount trace_save()
+{
+  TraceCount count = {0};
+#ifdef CONFIG_BTRACE
+  if (btrace_enabled())
+    count.btrace = btrace_count();
+#endif
+#ifdef CONFIG_FTRACE
+  if (ftrace_enabled())
+    count.ftrace = ftrace_count();
+#endif
+  return count;
+}
+
+static void trace_load(const TraceCount *count)
+{
+#ifdef CONFIG_BTRACE
+  if (btrace_enabled())
+    btrace_rewind(count->btrace);
+#endif
+#ifdef CONFIG_FTRACE
+  if (ftrace_enabled())
+    ftrace_rewind(count->ftrace);
+#endif
+}
+
+// wait for the session forked from this snapshot, and return in the new
+// session; 1 if the snapshot has been restored since, -1 if fork() fails
+static int freeze(int id)
+{
+  uint8_t *io = map_save();
+  TraceCount trace = trace_save();
+  for (int restored = 0;; restored = 1)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      start_session(id);
+      return restored;
+    }
+    if (pid < 0)
+    {
+      printf("can not fork: %s\n", strerror(errno));
+      if (restored)
+        _exit(1);
+      free(io);
+      return -1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    if (ctl->target == id)
+    {
+      ctl->target = -1;
+      map_load(io);
+      trace_load(&trace);
+      continue;
+    }
+    if (ctl->target >= 0 && ctl->target < id)
+      _exit(0);
+
+    // the session has ended, and so has this snapshot. The atexit()
+    // handlers have been run by the session and must not be run again
+    if (WIFSIGNALED(status))
+    {
+      signal(WTERMSIG(status), SIG_DFL);
+      raise(WTERMSIG(status));
+    }
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+  }
+}
+
+void snapshot_take()
+{
+  if (nr_snapshot == NR_SNAPSHOT)
+  {
+    printf("too many snapshots, restore an earlier one to drop the later ones\n");
+    return;
+  }
+  if (ctl == NULL)
+  {
+    ctl = mmap(NULL, sizeof(*ctl), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED)
+    {
+      ctl = NULL;
+      printf("can not map the control page: %s\n", strerror(errno));
+      return;
+    }
+    ctl->target = -1;
+  }
+
+  int id = nr_snapshot++;
+  snapshot[id] = (Snapshot){.pc = cpu.pc, .nr_inst = g_nr_guest_inst, .time = get_time()};
+  // the buffered output would be printed by both processes otherwise
+  log_flush();
+  fflush(stdout);
+  int ret = freeze(id);
+  if (ret < 0)
+  {
+    nr_snapshot--;
+    return;
+  }
+  printf("%s %d at " FMT_WORD ", %" PRIu64 " instructions\n", ret ? "Restored snapshot" : "Snapshot",
+         id, snapshot[id].pc, snapshot[id].nr_inst);
+}
+
+void snapshot_restore(char *args)
+{
+  char *end;
+  long id = strtol(args, &end, 0);
+  if (*end != '\0' || id < 0 || id >= nr_snapshot)
+  {
+    printf("no snapshot %s\n", args);
+    return;
+  }
+  ctl->target = id;
+  log_flush();
+  fflush(stdout);
+  // skip the atexit() handlers, the restored snapshot will run them
+  _exit(0);
+}
+
+void displaySnapshot()
+{
+  if (nr_snapshot == 0)
+  {
+    printf("no snapshot\n");
+    return;
+  }
+  printf("Num\tPC\t\tInstructions\n");
+  for (int i = 0; i < nr_snapshot; i++)
+  {
+    printf("%d\t" FMT_WORD "\t%" PRIu64 "\n", i, snapshot[i].pc, snapshot[i].nr_inst);
+  }
+}
@@ -1,4 +1,5 @@
 #include "sdb.h"
+#include <memory/paddr.h>
 
 #define NR_WP 50
 
@@ -9,6 +10,11 @@ typedef struct watchpoint
   /* TODO: Add more members if necessary */
   char str[32];
   uint32_t oldval; // TODO:
+  ExprCode code;
+  word_t *reg_val;     // values of code.reg when last evaluated
+  paddr_t *load_addr;  // addresses loaded from when last evaluated
+  uint32_t *load_val;
+  int nr_load;         // fewer than code.nr_load if the last evaluation failed
 } WP;
 
 WP *new_wp();
@@ -66,6 +72,10 @@ void free_wp(int num)
   assert(p->next != NULL); // p->next->no==num
   WP *wp = p->next;
   p->next = p->next->next;
+  expr_free(&wp->code);
+  free(wp->reg_val);
+  free(wp->load_addr);
+  free(wp->load_val);
   wp->next = free_->next;
   free_->next = wp;
   printf("delete watchpoint %d\n", num);
@@ -85,24 +95,82 @@ void displayWp()
     p = p->next;
   }
 }
+/* Evaluate the compiled expression of `p`, and remember the registers
+ * and the memory it depends on. If the evaluation fails, the loads done
+ * before the failure are kept, since the failure depends on them too.
+ */
+static word_t wp_eval(WP *p, bool *success)
+{
+  word_t val = expr_run(&p->code, p->load_addr, &p->nr_load, success);
+  for (int i = 0; i < p->code.nr_reg; i++)
+  {
+    p->reg_val[i] = *p->code.reg[i];
+  }
+  for (int i = 0; i < p->nr_load; i++)
+  {
+    p->load_val[i] = getnum(p->load_addr[i]);
+  }
+  return val;
+}
+
+// whether a register or a memory word `p` depends on has changed
+static bool wp_dirty(WP *p)
+{
+  for (int i = 0; i < p->code.nr_reg; i++)
+  {
+    if (*p->code.reg[i] != p->reg_val[i])
+      return true;
+  }
+  for (int i = 0; i < p->nr_load; i++)
+  {
+    if (getnum(p->load_addr[i]) != p->load_val[i])
+      return true;
+  }
+  return false;
+}
+
 void setwp(char *args)
 {
+  ExprCode code;
+  if (strlen(args) >= 32 || !expr_compile(args, &code))
+  {
+    printf("invalid watch expression: %s\n", args);
+    return;
+  }
   WP *ret = new_wp();
-  assert(strlen(args) < 32);
+  memset(ret->str, 0, sizeof(ret->str));
   memcpy(ret->str, args, strlen(args));
+  ret->code = code;
+  ret->reg_val = malloc(sizeof(word_t) * (code.nr_reg + 1));
+  ret->load_addr = malloc(sizeof(paddr_t) * (code.nr_load + 1));
+  ret->load_val = malloc(sizeof(uint32_t) * (code.nr_load + 1));
+  assert(ret->reg_val && ret->load_addr && ret->load_val);
   bool success = true;
-  ret->oldval = expr(ret->str, &success);
+  ret->oldval = wp_eval(ret, &success);
   printf("Watchpoint %d : %s\n", ret->NO, ret->str);
 }
+bool wp_active()
+{
+  return head != NULL && head->next != NULL;
+}
+/* Called after each instruction. An expression is only re-evaluated when
+ * a register or a memory word it reads may have changed. Running with a
+ * watchpoint is about half as fast as running without one.
+ */
 bool scanwp()
 {
   bool changed = false;
   WP *p = head->next;
   while (p != NULL)
   {
+    if (!wp_dirty(p))
+    {
+      p = p->next;
+      continue;
+    }
     bool success = true;
-    uint32_t newval = expr(p->str, &success);
-    if (p->oldval != newval)
+    uint32_t newval = wp_eval(p, &success);
+    if (success && p->oldval != newval)
     {
       printf("\nWatchpoint %d: %s\n", p->NO, p->str);
       printf("old value = %u\n", p->oldval);
@@ -0,0 +1,73 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_BTRACE
+#include <cpu/btrace.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+BTraceHeader *btrace_hdr = NULL;
+uint8_t *btrace_ring = NULL;
+uint64_t btrace_mask = 0;
+
+static int btrace_fd = -1;
+static size_t btrace_map_size = 0;
+
+// Drop the unused part of the ring, so that a short run
+// does not leave a file of CONFIG_BTRACE_SIZE behind.
+static void close_btrace() {
+  uint64_t nr_record = btrace_hdr->nr_record;
+  uint64_t nr_valid = (nr_record < btrace_hdr->nr_slot ? nr_record : btrace_hdr->nr_slot);
+  munmap(btrace_hdr, btrace_map_size);
+  btrace_hdr = NULL;
+  int ret = ftruncate(btrace_fd, BTRACE_HDR_SIZE + nr_valid * BTRACE_RECORD_SIZE(BTRACE_FLAGS));
+  assert(ret == 0);
+  close(btrace_fd);
+}
+
+void init_btrace(const char *file) {
+  if (file == NULL) return;
+
+  uint64_t record_size = BTRACE_RECORD_SIZE(BTRACE_FLAGS);
+  uint64_t nr_slot = 1;
+  while (nr_slot * 2 * record_size <= (uint64_t)CONFIG_BTRACE_SIZE * 1024 * 1024) nr_slot *= 2;
+
+  btrace_fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(btrace_fd >= 0, "Can not open '%s'", file);
+  btrace_map_size = BTRACE_HDR_SIZE + nr_slot * record_size;
+  // the file stays sparse until the ring is filled
+  int ret = ftruncate(btrace_fd, btrace_map_size);
+  Assert(ret == 0, "Can not resize '%s'", file);
+  void *p = mmap(NULL, btrace_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, btrace_fd, 0);
+  Assert(p != MAP_FAILED, "Can not map '%s'", file);
+
+  btrace_hdr = p;
+  btrace_ring = (uint8_t *)p + BTRACE_HDR_SIZE;
+  btrace_mask = nr_slot - 1;
+  memcpy(btrace_hdr->magic, BTRACE_MAGIC, sizeof(btrace_hdr->magic));
+  btrace_hdr->version = BTRACE_VERSION;
+  btrace_hdr->flags = BTRACE_FLAGS;
+  strncpy(btrace_hdr->isa, str(__GUEST_ISA__), sizeof(btrace_hdr->isa) - 1);
+  btrace_hdr->record_size = record_size;
+  btrace_hdr->nr_slot = nr_slot;
+  btrace_hdr->nr_record = 0;
+  atexit(close_btrace);
+
+  Log("Binary instruction trace is written to %s (%" PRIu64 " records at most)", file, nr_slot);
+}
+#endif
@@ -0,0 +1,238 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+#ifdef CONFIG_CHECKPOINT
+#include <memory/paddr.h>
+#include <device/map.h>
+#include <zlib.h>
+
+/* A checkpoint is a header followed by sections, each of which is a
+ * CkptSection and its content. A region is stored as runs of pages, each
+ * of which is a CkptRun followed by the compressed data, or nothing for a
+ * run of blank pages, and the runs end with one of zero length. A blank
+ * page is a zero one, or for pmem one still holding what it is filled
+ * with at startup, which is random with MEM_RANDOM. The seed of the
+ * random content is saved before the runs of pmem, so that the blank
+ * pages are filled the same way when restored. The integers are in the
+ * byte order of the host, and the sections must come in the order NEMU
+ * of the same configuration saves them.
+ */
+#define CKPT_MAGIC "NEMUCKP"
+#define CKPT_VERSION 2
+// the largest run compressed as a whole, and the largest run of blank pages
+#define CKPT_RUN_MAX (256 * 1024)
+#define CKPT_BLANK_RUN_MAX (1u << 30)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  char isa[12];
+  uint64_t mbase, msize;
+} CkptHeader;
+
+typedef struct {
+  char name[32];
+  uint64_t size; // of the content
+} CkptSection;
+
+typedef struct {
+  uint64_t offset;
+  uint32_t len;
+  uint32_t zlen; // 0 for a run of blank pages
+} CkptRun;
+
+extern uint64_t g_nr_guest_inst;
+
+static FILE *ckpt_fp = NULL;
+static const char *ckpt_file = NULL;
+static bool ckpt_is_save = false;
+// the current section, and where it is in the file
+static CkptSection section = {};
+static long section_start = 0;
+static uint8_t zero_page[PAGE_SIZE] = {};
+static uint8_t *zbuf = NULL;
+
+static void ckpt_read(void *buf, size_t len) {
+  Assert(fread(buf, len, 1, ckpt_fp) == 1, "Checkpoint '%s' is truncated in section '%s'", ckpt_file, section.name);
+}
+
+// finish the current section
+static void section_end() {
+  if (section_start == 0) return;
+  long end = ftell(ckpt_fp);
+  if (ckpt_is_save) {
+    section.size = end - section_start;
+    fseek(ckpt_fp, section_start - sizeof(section), SEEK_SET);
+    fwrite(&section, sizeof(section), 1, ckpt_fp);
+    fseek(ckpt_fp, end, SEEK_SET);
+  } else {
+    Assert(end - section_start == section.size, "Section '%s' of checkpoint '%s' has %" PRIu64
+        " bytes, but %ld bytes are expected", section.name, ckpt_file, section.size, end - section_start);
+  }
+}
+
+void ckpt_section(const char *kind, const char *name) {
+  section_end();
+  char full[sizeof(section.name)];
+  snprintf(full, sizeof(full), "%s/%s", kind, name);
+  if (ckpt_is_save) {
+    memset(&section, 0, sizeof(section));
+    strcpy(section.name, full);
+    fwrite(&section, sizeof(section), 1, ckpt_fp);
+  } else {
+    ckpt_read(&section, sizeof(section));
+    section.name[sizeof(section.name) - 1] = '\0';
+    Assert(strcmp(section.name, full) == 0, "Checkpoint '%s' has section '%s' where '%s' is expected. "
+        "Is it saved by NEMU of another configuration?", ckpt_file, section.name, full);
+  }
+  section_start = ftell(ckpt_fp);
+}
+
+void ckpt_data(void *buf, size_t len) {
+  if (ckpt_is_save) fwrite(buf, len, 1, ckpt_fp);
+  else ckpt_read(buf, len);
+}
+
+static bool page_is_blank(const uint8_t *p, size_t off, size_t len, bool is_pmem) {
+  if (is_pmem) return pmem_blank(CONFIG_MBASE + off, len);
+  return memcmp(p + off, zero_page, len) == 0;
+}
+
+// split [0, len) into runs of blank or other pages
+static void save_region(uint8_t *buf, size_t len, bool is_pmem) {
+  size_t off = 0;
+  while (off < len) {
+    size_t n = (len - off < PAGE_SIZE ? len - off : PAGE_SIZE);
+    bool blank = page_is_blank(buf, off, n, is_pmem);
+    CkptRun run = { .offset = off, .len = n };
+    for (off += n; off < len && run.len < (blank ? CKPT_BLANK_RUN_MAX : CKPT_RUN_MAX); off += n, run.len += n) {
+      n = (len - off < PAGE_SIZE ? len - off : PAGE_SIZE);
+      if (page_is_blank(buf, off, n, is_pmem) != blank) break;
+    }
+    if (!blank) {
+      uLongf zlen = compressBound(CKPT_RUN_MAX);
+      int ret = compress2(zbuf, &zlen, buf + run.offset, run.len, Z_BEST_SPEED);
+      assert(ret == Z_OK);
+      run.zlen = zlen;
+    }
+    fwrite(&run, sizeof(run), 1, ckpt_fp);
+    if (!blank) fwrite(zbuf, run.zlen, 1, ckpt_fp);
+  }
+  CkptRun end = {};
+  fwrite(&end, sizeof(end), 1, ckpt_fp);
+}
+
+static void load_region(uint8_t *buf, size_t len, bool is_pmem) {
+  while (true) {
+    CkptRun run;
+    ckpt_read(&run, sizeof(run));
+    if (run.len == 0) break;
+    Assert(run.offset + run.len <= len && (run.zlen == 0 || run.len <= CKPT_RUN_MAX) &&
+        run.zlen <= compressBound(CKPT_RUN_MAX),
+        "Bad run in section '%s' of checkpoint '%s'", section.name, ckpt_file);
+    if (run.zlen == 0) {
+      if (is_pmem) pmem_reset(CONFIG_MBASE + run.offset, run.len);
+      else memset(buf + run.offset, 0, run.len);
+      continue;
+    }
+    ckpt_read(zbuf, run.zlen);
+    if (is_pmem) pmem_touch(CONFIG_MBASE + run.offset, run.len);
+    uLongf n = run.len;
+    int ret = uncompress(buf + run.offset, &n, zbuf, run.zlen);
+    Assert(ret == Z_OK && n == run.len, "Bad data in section '%s' of checkpoint '%s'", section.name, ckpt_file);
+  }
+}
+
+void ckpt_region(void *buf, size_t len) {
+  if (ckpt_is_save) save_region(buf, len, false);
+  else load_region(buf, len, false);
+}
+
+// the sections of everything, in the same order for saving and loading
+static void checkpoint(bool is_save) {
+  ckpt_is_save = is_save;
+  section_start = 0;
+  if (zbuf == NULL) {
+    zbuf = malloc(compressBound(CKPT_RUN_MAX));
+    assert(zbuf);
+  }
+
+  ckpt_section("cpu", str(__GUEST_ISA__));
+  ckpt_data(&cpu, sizeof(cpu));
+
+  ckpt_section("nemu", "state");
+  uint64_t time = get_time();
+  ckpt_data(&g_nr_guest_inst, sizeof(g_nr_guest_inst));
+  ckpt_data(&time, sizeof(time));
+  if (!is_save) set_time(time);
+
+  ckpt_section("memory", "pmem");
+  uint64_t seed = pmem_seed();
+  ckpt_data(&seed, sizeof(seed));
+  if (!is_save) pmem_set_seed(seed);
+  if (is_save) save_region(guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, true);
+  else load_region(guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, true);
+
+  IFDEF(CONFIG_DEVICE, map_checkpoint(is_save));
+  section_end();
+}
+
+static void make_header(CkptHeader *h) {
+  memset(h, 0, sizeof(*h));
+  strcpy(h->magic, CKPT_MAGIC);
+  h->version = CKPT_VERSION;
+  strncpy(h->isa, str(__GUEST_ISA__), sizeof(h->isa) - 1);
+  h->mbase = CONFIG_MBASE;
+  h->msize = CONFIG_MSIZE;
+}
+
+bool checkpoint_save(const char *file) {
+  ckpt_fp = fopen(file, "wb");
+  if (ckpt_fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+  ckpt_file = file;
+  CkptHeader h;
+  make_header(&h);
+  fwrite(&h, sizeof(h), 1, ckpt_fp);
+  checkpoint(true);
+  bool ok = !ferror(ckpt_fp);
+  ok = (fclose(ckpt_fp) == 0) && ok;
+  ckpt_fp = NULL;
+  if (!ok) printf("Can not write '%s'\n", file);
+  return ok;
+}
+
+void checkpoint_restore(const char *file) {
+  ckpt_fp = fopen(file, "rb");
+  Assert(ckpt_fp, "Can not open '%s'", file);
+  ckpt_file = file;
+  CkptHeader h, expect;
+  make_header(&expect);
+  Assert(fread(&h, sizeof(h), 1, ckpt_fp) == 1 && memcmp(h.magic, expect.magic, sizeof(h.magic)) == 0,
+      "'%s' is not a checkpoint", file);
+  Assert(h.version == expect.version, "Checkpoint '%s' is of version %d, but %d is supported",
+      file, h.version, expect.version);
+  Assert(memcmp(&h, &expect, sizeof(h)) == 0, "Checkpoint '%s' is saved by NEMU of %s "
+      "with pmem [%#" PRIx64 ", %#" PRIx64 ")", file, h.isa, h.mbase, h.mbase + h.msize);
+  checkpoint(false);
+  fclose(ckpt_fp);
+  ckpt_fp = NULL;
+  Log("Restored from checkpoint %s at pc = " FMT_WORD, file, cpu.pc);
+}
+#endif
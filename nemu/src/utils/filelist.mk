@@ -13,8 +13,16 @@
 # See the Mulan PSL v2 for more details.
 #**************************************************************************************/
 
-ifdef CONFIG_ITRACE
+ifneq ($(CONFIG_ITRACE)$(CONFIG_IRINGBUF),)
 CXXSRC = src/utils/disasm.cc
 CXXFLAGS += $(shell llvm-config --cxxflags) -fPIE
 LIBS += $(shell llvm-config --libs)
 endif
+
+ifdef CONFIG_LOG_ASYNC
+LIBS += -lpthread
+endif
+
+ifdef CONFIG_CHECKPOINT
+LIBS += -lz
+endif
@@ -0,0 +1,222 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_FTRACE
+#include <isa.h>
+#include <cpu/ftrace.h>
+#include <ftrace-def.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Calls and returns reported by isa_call_type() are appended to a ring
+ * of events mapped from the trace file, and also drive a shadow stack
+ * of the guest. When a frame is popped, the instructions executed in
+ * it are added to its function: all of them to the exclusive count
+ * except those of the callees, and all of them to the inclusive count
+ * unless the function is still active further up in the stack, so that
+ * recursion is not counted twice.
+ */
+
+#define MAX_DEPTH 4096
+
+typedef struct {
+  vaddr_t entry;
+  uint32_t active; // number of frames of this function in the stack
+  uint64_t calls, incl, excl;
+} FuncStat;
+
+typedef struct {
+  uint32_t func;
+  uint64_t start; // g_nr_guest_inst at the call
+  uint64_t child; // instructions executed in the callees
+} Frame;
+
+extern uint64_t g_nr_guest_inst;
+
+bool ftrace_on = false;
+
+static const char *ftrace_file = NULL;
+static int ftrace_fd = -1;
+static size_t ftrace_map_size = 0;
+static FTraceHeader *hdr = NULL;
+static FTraceEvent *ring = NULL;
+static uint64_t ring_mask = 0;
+
+static FuncStat *funcs = NULL;
+static uint32_t nr_func = 0, max_func = 0;
+static uint32_t *func_table = NULL; // index + 1 into funcs, 0 if empty
+static uint32_t func_table_mask = 0;
+
+static Frame stack[MAX_DEPTH];
+static uint32_t nr_frame = 0;
+static uint32_t nr_overflow = 0; // calls not pushed since the stack is full
+
+static inline uint32_t func_hash(vaddr_t entry) {
+  return ((uint64_t)entry * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static void func_table_resize(uint32_t size) {
+  free(func_table);
+  func_table = calloc(size, sizeof(func_table[0]));
+  assert(func_table);
+  func_table_mask = size - 1;
+  uint32_t i;
+  for (i = 0; i < nr_func; i ++) {
+    uint32_t h = func_hash(funcs[i].entry) & func_table_mask;
+    while (func_table[h] != 0) h = (h + 1) & func_table_mask;
+    func_table[h] = i + 1;
+  }
+}
+
+static uint32_t func_get(vaddr_t entry) {
+  uint32_t h = func_hash(entry) & func_table_mask;
+  for (; func_table[h] != 0; h = (h + 1) & func_table_mask) {
+    if (funcs[func_table[h] - 1].entry == entry) return func_table[h] - 1;
+  }
+  if (nr_func == max_func) {
+    max_func *= 2;
+    funcs = realloc(funcs, sizeof(FuncStat) * max_func);
+    assert(funcs);
+  }
+  funcs[nr_func] = (FuncStat) { .entry = entry };
+  func_table[h] = ++ nr_func;
+  if (nr_func * 2 > func_table_mask) func_table_resize((func_table_mask + 1) * 2);
+  return nr_func - 1;
+}
+
+static void push(vaddr_t entry) {
+  uint32_t f = func_get(entry);
+  funcs[f].calls ++;
+  funcs[f].active ++;
+  stack[nr_frame ++] = (Frame) { .func = f, .start = g_nr_guest_inst, .child = 0 };
+}
+
+static void pop() {
+  Frame *fr = &stack[-- nr_frame];
+  FuncStat *f = &funcs[fr->func];
+  uint64_t incl = g_nr_guest_inst - fr->start;
+  f->excl += incl - fr->child;
+  if (-- f->active == 0) f->incl += incl;
+  if (nr_frame > 0) stack[nr_frame - 1].child += incl;
+}
+
+static void record(int type, Decode *s, uint32_t depth) {
+  FTraceEvent *e = &ring[hdr->nr_event ++ & ring_mask];
+  *e = (FTraceEvent) { .icount = g_nr_guest_inst, .pc = s->pc, .target = s->dnpc,
+    .type = type, .depth = depth };
+}
+
+void ftrace_jump(Decode *s) {
+  uint32_t depth = nr_frame - 1 + nr_overflow;
+  switch (isa_call_type(s)) {
+    case CALL_CALL:
+      record(FTRACE_CALL, s, depth + 1);
+      if (nr_frame == MAX_DEPTH) nr_overflow ++;
+      else push(s->dnpc);
+      break;
+    case CALL_RET:
+      record(FTRACE_RET, s, depth);
+      if (nr_overflow > 0) nr_overflow --;
+      else if (nr_frame > 1) pop(); // never pop the root function
+      break;
+  }
+}
+
+static int excl_cmp(const void *a, const void *b) {
+  uint64_t x = ((const FuncStat *)a)->excl, y = ((const FuncStat *)b)->excl;
+  return (x < y) - (x > y);
+}
+
+static const char *func_name(vaddr_t entry, char *buf, size_t size) {
+  vaddr_t start;
+  const char *name = symbol_lookup(entry, &start);
+  if (name == NULL) snprintf(buf, size, FMT_WORD, entry);
+  else if (start != entry) snprintf(buf, size, "%s+0x%x", name, (uint32_t)(entry - start));
+  else return name;
+  return buf;
+}
+
+static void close_ftrace() {
+  while (nr_frame > 0) pop();
+  qsort(funcs, nr_func, sizeof(FuncStat), excl_cmp);
+
+  char file[1024], buf[64];
+  snprintf(file, sizeof(file), "%s.funcs", ftrace_file);
+  FILE *fp = fopen(file, "w");
+  Assert(fp, "Can not open '%s'", file);
+  fprintf(fp, "# %18s %18s %12s  function\n", "exclusive", "inclusive", "calls");
+  uint32_t i;
+  for (i = 0; i < nr_func; i ++) {
+    FuncStat *f = &funcs[i];
+    fprintf(fp, "%20" PRIu64 " %18" PRIu64 " %12" PRIu64 "  %s\n",
+        f->excl, f->incl, f->calls, func_name(f->entry, buf, sizeof(buf)));
+  }
+  fclose(fp);
+
+  uint64_t nr_event = hdr->nr_event;
+  uint64_t nr_valid = (nr_event < hdr->nr_slot ? nr_event : hdr->nr_slot);
+  munmap(hdr, ftrace_map_size);
+  int ret = ftruncate(ftrace_fd, FTRACE_HDR_SIZE + nr_valid * sizeof(FTraceEvent));
+  assert(ret == 0);
+  close(ftrace_fd);
+  Log("Function trace of %" PRIu64 " events is written to %s, "
+      "and the costs of %u functions to %s", nr_event, ftrace_file, nr_func, file);
+}
+
+// the ring is shared by the snapshots, which rewind it on restore
+uint64_t ftrace_count() {
+  return hdr->nr_event;
+}
+
+void ftrace_rewind(uint64_t nr_event) {
+  hdr->nr_event = nr_event;
+}
+
+// Called after the image is loaded, so that the root frame starts at the entry.
+void init_ftrace(const char *file) {
+  if (file == NULL) return;
+  ftrace_file = file;
+
+  uint64_t nr_slot = 1;
+  while (nr_slot * 2 * sizeof(FTraceEvent) <= (uint64_t)CONFIG_FTRACE_SIZE * 1024 * 1024) nr_slot *= 2;
+  ftrace_fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(ftrace_fd >= 0, "Can not open '%s'", file);
+  ftrace_map_size = FTRACE_HDR_SIZE + nr_slot * sizeof(FTraceEvent);
+  int ret = ftruncate(ftrace_fd, ftrace_map_size);
+  Assert(ret == 0, "Can not resize '%s'", file);
+  void *p = mmap(NULL, ftrace_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ftrace_fd, 0);
+  Assert(p != MAP_FAILED, "Can not map '%s'", file);
+
+  hdr = p;
+  ring = (FTraceEvent *)((uint8_t *)p + FTRACE_HDR_SIZE);
+  ring_mask = nr_slot - 1;
+  memcpy(hdr->magic, FTRACE_MAGIC, sizeof(hdr->magic));
+  hdr->version = FTRACE_VERSION;
+  strncpy(hdr->isa, str(__GUEST_ISA__), sizeof(hdr->isa) - 1);
+  hdr->nr_slot = nr_slot;
+  hdr->nr_event = 0;
+
+  max_func = 1024;
+  funcs = malloc(sizeof(FuncStat) * max_func);
+  assert(funcs);
+  func_table_resize(4096);
+  push(cpu.pc);
+  ftrace_on = true;
+  atexit(close_ftrace);
+}
+#endif
@@ -18,6 +18,135 @@
 extern uint64_t g_nr_guest_inst;
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+/* The simulation thread is the only producer and the log thread is the only
+ * consumer of this ring, so they synchronize through `head` and `tail` alone.
+ * The log thread advances `tail` after the data is written and flushed, so
+ * the log file is up to date once `tail` catches up with `head`. When the
+ * ring is empty, the log thread sleeps on `log_cond` and sets `log_sleeping`
+ * for the producer to wake it up. Only a log file is written by the thread,
+ * the log to stdout is written directly to keep its order with printf().
+ */
+#define LOG_BUF_SIZE (CONFIG_LOG_BUF_SIZE * 1024)
+#define LOG_LINE_MAX 4096
+
+static char log_buf[LOG_BUF_SIZE];
+static _Atomic uint64_t log_head = 0;
+static _Atomic uint64_t log_tail = 0;
+static bool log_thread_running = false;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic bool log_sleeping = false;
+
+static void log_wait(uint64_t tail) {
+  pthread_mutex_lock(&log_lock);
+  // ordered against the store of `head` in log_printf(), so that either
+  // the producer sees the flag, or the new `head` is seen here
+  atomic_store(&log_sleeping, true);
+  while (atomic_load(&log_head) == tail) {
+    pthread_cond_wait(&log_cond, &log_lock);
+  }
+  atomic_store(&log_sleeping, false);
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void* log_thread(void *arg) {
+  while (true) {
+    uint64_t tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&log_head, memory_order_acquire);
+    if (head == tail) {
+      log_wait(tail);
+      continue;
+    }
+    uint64_t start = tail % LOG_BUF_SIZE;
+    uint64_t len = head - tail;
+    if (start + len > LOG_BUF_SIZE) {
+      fwrite(log_buf + start, 1, LOG_BUF_SIZE - start, log_fp);
+      fwrite(log_buf, 1, start + len - LOG_BUF_SIZE, log_fp);
+    } else {
+      fwrite(log_buf + start, 1, len, log_fp);
+    }
+    fflush(log_fp);
+    atomic_store_explicit(&log_tail, head, memory_order_release);
+  }
+  return NULL;
+}
+
+void log_printf(const char *fmt, ...) {
+  char line[LOG_LINE_MAX];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+  if (len <= 0) return;
+
+  if (!log_thread_running) {
+    fwrite(line, 1, len, log_fp);
+    fflush(log_fp);
+    return;
+  }
+
+  uint64_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+  // wait for the log thread if the ring is full
+  while (head + len - atomic_load_explicit(&log_tail, memory_order_acquire) > LOG_BUF_SIZE) {
+    sched_yield();
+  }
+  uint64_t start = head % LOG_BUF_SIZE;
+  if (start + len > LOG_BUF_SIZE) {
+    memcpy(log_buf + start, line, LOG_BUF_SIZE - start);
+    memcpy(log_buf, line + LOG_BUF_SIZE - start, start + len - LOG_BUF_SIZE);
+  } else {
+    memcpy(log_buf + start, line, len);
+  }
+  atomic_store(&log_head, head + len);
+  if (atomic_load(&log_sleeping)) {
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+  }
+}
+#endif
+
+#ifdef CONFIG_LOG_ASYNC
+static void start_log_thread() {
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, log_thread, NULL);
+  Assert(ret == 0, "Can not create the log thread");
+  pthread_detach(thread);
+  log_thread_running = true;
+}
+#endif
+
+// threads are not inherited by fork(), so the child starts its own log thread
+void log_after_fork() {
+#ifdef CONFIG_LOG_ASYNC
+  if (log_thread_running) {
+    // the copies may still record the log thread of the parent as a waiter
+    pthread_mutex_init(&log_lock, NULL);
+    pthread_cond_init(&log_cond, NULL);
+    atomic_store(&log_sleeping, false);
+    start_log_thread();
+  }
+#endif
+}
+
+// wait until all messages are written to the log file
+void log_flush() {
+#ifdef CONFIG_LOG_ASYNC
+  uint64_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+  while (atomic_load_explicit(&log_tail, memory_order_acquire) != head) {
+    sched_yield();
+  }
+#endif
+  if (log_fp != NULL) fflush(log_fp);
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
@@ -25,6 +154,13 @@ void init_log(const char *log_file) {
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
   }
+#ifdef CONFIG_LOG_ASYNC
+  static_assert((LOG_BUF_SIZE & (LOG_BUF_SIZE - 1)) == 0, "LOG_BUF_SIZE should be a power of 2");
+  if (log_fp != stdout) {
+    start_log_thread();
+    atexit(log_flush);
+  }
+#endif
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
 
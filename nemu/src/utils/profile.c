@@ -0,0 +1,383 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_PROFILE
+#include <isa.h>
+#include <cpu/profile.h>
+
+/* Executions are counted per (calling context, pc) in an open addressing
+ * table. A calling context is a node of the call tree, which is built from
+ * the calls and returns reported by isa_call_type(). At exit, the counts
+ * are symbolized and written as folded stacks for flamegraph.pl, and as
+ * a pprof profile.
+ */
+
+#define MAX_DEPTH 256
+
+typedef struct {
+  uint32_t parent;
+  uint32_t depth;
+  vaddr_t site;   // pc of the call instruction
+  vaddr_t target; // entry of the callee
+} Context;
+
+ProfEntry *prof_table = NULL;
+uint32_t prof_ctx = 0; // 0 is the root
+int prof_shift = 0;
+static uint64_t prof_used = 0;
+
+static Context *ctx = NULL;
+static uint32_t nr_ctx = 0, max_ctx = 0;
+// children of each node, indexed by the hash of (parent, site, target)
+static uint32_t *ctx_table = NULL;
+static uint64_t ctx_mask = 0;
+// calls beyond MAX_DEPTH are not recorded, only counted to match the returns
+static uint64_t nr_overflow = 0;
+
+static const char *prof_file = NULL;
+
+static inline uint64_t ctx_hash(uint32_t parent, vaddr_t site, vaddr_t target) {
+  return ((uint64_t)parent * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)site * 0xbf58476d1ce4e5b9ull) ^ target;
+}
+
+static void ctx_table_resize(uint64_t size) {
+  free(ctx_table);
+  ctx_table = calloc(size, sizeof(ctx_table[0]));
+  assert(ctx_table);
+  ctx_mask = size - 1;
+  uint32_t i;
+  for (i = 1; i < nr_ctx; i ++) {
+    uint64_t h = ctx_hash(ctx[i].parent, ctx[i].site, ctx[i].target) & ctx_mask;
+    while (ctx_table[h] != 0) h = (h + 1) & ctx_mask;
+    ctx_table[h] = i;
+  }
+}
+
+static uint32_t ctx_child(uint32_t parent, vaddr_t site, vaddr_t target) {
+  uint64_t h = ctx_hash(parent, site, target) & ctx_mask;
+  for (; ctx_table[h] != 0; h = (h + 1) & ctx_mask) {
+    Context *c = &ctx[ctx_table[h]];
+    if (c->parent == parent && c->site == site && c->target == target) return ctx_table[h];
+  }
+  if (nr_ctx == max_ctx) {
+    max_ctx *= 2;
+    ctx = realloc(ctx, sizeof(Context) * max_ctx);
+    assert(ctx);
+  }
+  uint32_t id = nr_ctx ++;
+  ctx[id] = (Context) { .parent = parent, .depth = ctx[parent].depth + 1, .site = site, .target = target };
+  ctx_table[h] = id;
+  if (nr_ctx * 2 > ctx_mask) ctx_table_resize((ctx_mask + 1) * 2);
+  return id;
+}
+
+void profile_jump(Decode *s) {
+  switch (isa_call_type(s)) {
+    case CALL_CALL:
+      if (ctx[prof_ctx].depth == MAX_DEPTH) nr_overflow ++;
+      else prof_ctx = ctx_child(prof_ctx, s->pc, s->dnpc);
+      break;
+    case CALL_RET:
+      if (nr_overflow > 0) nr_overflow --;
+      else prof_ctx = ctx[prof_ctx].parent;
+      break;
+  }
+}
+
+static inline uint64_t prof_hash(vaddr_t pc, uint32_t c) {
+  return ((pc >> 2) ^ ((uint64_t)c << 32)) * 0x9e3779b97f4a7c15ull >> prof_shift;
+}
+
+static void prof_table_resize(int bits) {
+  ProfEntry *old = prof_table;
+  uint64_t old_size = (old == NULL ? 0 : 1ull << (64 - prof_shift));
+  prof_table = calloc(1ull << bits, sizeof(ProfEntry));
+  assert(prof_table);
+  prof_shift = 64 - bits;
+  uint64_t i;
+  for (i = 0; i < old_size; i ++) {
+    if (old[i].count == 0) continue;
+    uint64_t h = prof_hash(old[i].pc, old[i].ctx), mask = (1ull << bits) - 1;
+    while (prof_table[h].count != 0) h = (h + 1) & mask;
+    prof_table[h] = old[i];
+  }
+  free(old);
+}
+
+// the slow path of profile_hit(): probe the following entries
+void profile_insert(vaddr_t pc) {
+  uint64_t mask = (1ull << (64 - prof_shift)) - 1;
+  uint64_t h = prof_hash(pc, prof_ctx);
+  for (; prof_table[h].count != 0; h = (h + 1) & mask) {
+    if (prof_table[h].pc == pc && prof_table[h].ctx == prof_ctx) {
+      prof_table[h].count ++;
+      return;
+    }
+  }
+  prof_table[h] = (ProfEntry) { .pc = pc, .ctx = prof_ctx, .count = 1 };
+  if (++ prof_used * 2 > mask) prof_table_resize(64 - prof_shift + 1);
+}
+
+// ------------------------ output ------------------------
+
+static char unknown_name[64];
+
+static const char* func_name(vaddr_t addr) {
+  const char *name = symbol_lookup(addr, NULL);
+  if (name != NULL) return name;
+  snprintf(unknown_name, sizeof(unknown_name), FMT_WORD, addr);
+  return unknown_name;
+}
+
+typedef struct {
+  char *stack;
+  uint64_t count;
+} Folded;
+
+static int folded_cmp(const void *a, const void *b) {
+  return strcmp(((const Folded *)a)->stack, ((const Folded *)b)->stack);
+}
+
+// Frames are named by the function of each call site, then of the pc,
+// so that a tail call does not break the stack.
+static void write_folded(const char *file) {
+  Folded *f = malloc(sizeof(Folded) * prof_used);
+  assert(f);
+  uint64_t i, n = 0, size = 1ull << (64 - prof_shift);
+  for (i = 0; i < size; i ++) {
+    ProfEntry *e = &prof_table[i];
+    if (e->count == 0) continue;
+    size_t len = 0, cap = 256;
+    char *buf = malloc(cap);
+    assert(buf);
+    vaddr_t frames[MAX_DEPTH + 1];
+    int nr = 0;
+    uint32_t c;
+    for (c = e->ctx; c != 0; c = ctx[c].parent) frames[nr ++] = ctx[c].site;
+    int j;
+    for (j = nr - 1; j >= -1; j --) {
+      const char *name = func_name(j >= 0 ? frames[j] : e->pc);
+      size_t l = strlen(name);
+      if (len + l + 2 > cap) {
+        cap = (len + l + 2) * 2;
+        buf = realloc(buf, cap);
+        assert(buf);
+      }
+      memcpy(buf + len, name, l);
+      len += l;
+      buf[len ++] = (j >= 0 ? ';' : '\0');
+    }
+    f[n ++] = (Folded) { .stack = buf, .count = e->count };
+  }
+  qsort(f, n, sizeof(Folded), folded_cmp);
+
+  FILE *fp = fopen(file, "w");
+  Assert(fp, "Can not open '%s'", file);
+  for (i = 0; i < n; i ++) {
+    uint64_t count = f[i].count;
+    while (i + 1 < n && strcmp(f[i].stack, f[i + 1].stack) == 0) {
+      free(f[i].stack);
+      count += f[++ i].count;
+    }
+    fprintf(fp, "%s %" PRIu64 "\n", f[i].stack, count);
+    free(f[i].stack);
+  }
+  fclose(fp);
+  free(f);
+}
+
+// a growable buffer to encode protocol buffers
+typedef struct {
+  uint8_t *p;
+  size_t len, cap;
+} PBuf;
+
+static void pb_raw(PBuf *b, const void *data, size_t len) {
+  if (b->len + len > b->cap) {
+    b->cap = (b->len + len) * 2;
+    b->p = realloc(b->p, b->cap);
+    assert(b->p);
+  }
+  memcpy(b->p + b->len, data, len);
+  b->len += len;
+}
+
+static void pb_varint(PBuf *b, uint64_t v) {
+  uint8_t buf[10];
+  int n = 0;
+  do {
+    buf[n ++] = (v & 0x7f) | (v >= 0x80 ? 0x80 : 0);
+    v >>= 7;
+  } while (v != 0);
+  pb_raw(b, buf, n);
+}
+
+static void pb_uint(PBuf *b, int field, uint64_t v) {
+  pb_varint(b, (field << 3) | 0);
+  pb_varint(b, v);
+}
+
+static void pb_bytes(PBuf *b, int field, const void *data, size_t len) {
+  pb_varint(b, (field << 3) | 2);
+  pb_varint(b, len);
+  pb_raw(b, data, len);
+}
+
+// append a sub-message and reset it
+static void pb_msg(PBuf *b, int field, PBuf *m) {
+  pb_bytes(b, field, m->p, m->len);
+  m->len = 0;
+}
+
+// Index of `x` in the sorted array `a` of `n` distinct values.
+static uint64_t find_index(const uint64_t *a, uint64_t n, uint64_t x) {
+  uint64_t l = 0, r = n;
+  while (l < r) {
+    uint64_t m = (l + r) / 2;
+    if (a[m] < x) l = m + 1;
+    else r = m;
+  }
+  return l;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t sort_unique(uint64_t *a, uint64_t n) {
+  qsort(a, n, sizeof(a[0]), u64_cmp);
+  uint64_t i, m = 0;
+  for (i = 0; i < n; i ++) {
+    if (m == 0 || a[m - 1] != a[i]) a[m ++] = a[i];
+  }
+  return m;
+}
+
+/* See https://github.com/google/pprof/blob/main/proto/profile.proto.
+ * Each address (pc and call sites) gets a location, and each function
+ * entry gets a function. The file is not compressed, which pprof accepts.
+ */
+static void write_pprof(const char *file) {
+  uint64_t i, size = 1ull << (64 - prof_shift);
+  // collect the addresses and the entries of their functions
+  uint64_t nr_addr = prof_used + nr_ctx;
+  uint64_t *addr = malloc(sizeof(uint64_t) * nr_addr);
+  uint64_t *func = malloc(sizeof(uint64_t) * nr_addr);
+  assert(addr && func);
+  uint64_t n = 0;
+  for (i = 0; i < size; i ++) {
+    if (prof_table[i].count != 0) addr[n ++] = prof_table[i].pc;
+  }
+  for (i = 1; i < nr_ctx; i ++) addr[n ++] = ctx[i].site;
+  nr_addr = sort_unique(addr, n);
+  uint64_t nr_func = 0;
+  for (i = 0; i < nr_addr; i ++) {
+    vaddr_t start;
+    if (symbol_lookup(addr[i], &start) != NULL) func[nr_func ++] = start;
+  }
+  nr_func = sort_unique(func, nr_func);
+
+  PBuf out = {}, m = {}, sub = {};
+  // string table: 0 is "", then the sample type, then function names
+  enum { STR_EMPTY, STR_TYPE, STR_UNIT, STR_FUNC };
+  pb_uint(&m, 1, STR_TYPE);
+  pb_uint(&m, 2, STR_UNIT);
+  pb_msg(&out, 1, &m); // sample_type
+
+  for (i = 0; i < size; i ++) {
+    ProfEntry *e = &prof_table[i];
+    if (e->count == 0) continue;
+    // location ids, leaf first
+    pb_varint(&sub, find_index(addr, nr_addr, e->pc) + 1);
+    uint32_t c;
+    for (c = e->ctx; c != 0; c = ctx[c].parent) {
+      pb_varint(&sub, find_index(addr, nr_addr, ctx[c].site) + 1);
+    }
+    pb_msg(&m, 1, &sub); // location_id, packed
+    pb_varint(&sub, e->count);
+    pb_msg(&m, 2, &sub); // value, packed
+    pb_msg(&out, 2, &m); // sample
+  }
+
+  pb_uint(&m, 1, 1); // id
+  pb_uint(&m, 7, 1); // has_functions
+  pb_msg(&out, 3, &m); // mapping
+
+  for (i = 0; i < nr_addr; i ++) {
+    pb_uint(&m, 1, i + 1); // id
+    pb_uint(&m, 2, 1); // mapping_id
+    pb_uint(&m, 3, addr[i]); // address
+    vaddr_t start;
+    if (symbol_lookup(addr[i], &start) != NULL) {
+      pb_uint(&sub, 1, find_index(func, nr_func, start) + 1); // function_id
+      pb_msg(&m, 4, &sub); // line
+    }
+    pb_msg(&out, 4, &m); // location
+  }
+
+  for (i = 0; i < nr_func; i ++) {
+    pb_uint(&m, 1, i + 1); // id
+    pb_uint(&m, 2, STR_FUNC + i); // name
+    pb_uint(&m, 3, STR_FUNC + i); // system_name
+    pb_msg(&out, 5, &m); // function
+  }
+
+  pb_bytes(&out, 6, "", 0);
+  pb_bytes(&out, 6, "instructions", 12);
+  pb_bytes(&out, 6, "count", 5);
+  for (i = 0; i < nr_func; i ++) {
+    const char *name = symbol_lookup(func[i], NULL);
+    pb_bytes(&out, 6, name, strlen(name));
+  }
+
+  pb_uint(&m, 1, STR_TYPE);
+  pb_uint(&m, 2, STR_UNIT);
+  pb_msg(&out, 11, &m); // period_type
+  pb_uint(&out, 12, 1); // period
+
+  FILE *fp = fopen(file, "wb");
+  Assert(fp, "Can not open '%s'", file);
+  fwrite(out.p, out.len, 1, fp);
+  fclose(fp);
+  free(out.p); free(m.p); free(sub.p);
+  free(addr); free(func);
+}
+
+static void close_profile() {
+  char file[1024];
+  snprintf(file, sizeof(file), "%s.folded", prof_file);
+  write_folded(file);
+  snprintf(file, sizeof(file), "%s.pb", prof_file);
+  write_pprof(file);
+  Log("Profile of %" PRIu64 " pcs in %u calling contexts is written to %s.{folded,pb}",
+      prof_used, nr_ctx, prof_file);
+}
+
+void init_profile(const char *file) {
+  if (file == NULL) return;
+  prof_file = file;
+  prof_table_resize(16);
+  max_ctx = 1024;
+  ctx = malloc(sizeof(Context) * max_ctx);
+  assert(ctx);
+  ctx[0] = (Context) { .parent = 0, .depth = 0 };
+  nr_ctx = 1;
+  ctx_table_resize(4096);
+  atexit(close_profile);
+}
+#endif
@@ -0,0 +1,217 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_SIMPOINT
+#include <cpu/simpoint.h>
+#include <isa.h>
+
+/* A basic block vector counts the instructions executed in each block
+ * during an interval of CONFIG_SIMPOINT_INTERVAL instructions, counted
+ * from the first instruction of the guest. A block is keyed by the PC
+ * it starts at, and ends at a control transfer. The vectors are written
+ * in the input format of SimPoint, one line for each interval:
+ *   T:id:count :id:count ...
+ * where the blocks are numbered from 1 in the order they are first seen.
+ */
+#define INTERVAL ((uint64_t)CONFIG_SIMPOINT_INTERVAL)
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t id; // 0 means the slot is empty
+} BBVSlot;
+
+bool bbv_on = false;
+uint64_t bbv_len = 0;
+bool simpoint_on = false;
+uint64_t simpoint_next = 0;
+
+static FILE *bbv_fp = NULL;
+static vaddr_t bbv_start = 0;
+static BBVSlot *bbv_table = NULL;
+static int bbv_shift = 0;
+static uint32_t nr_block = 0;
+// the count of each block in the current interval, indexed by id
+static uint64_t *bbv_count = NULL;
+static uint32_t count_size = 0;
+// the blocks with a non-zero count
+static uint32_t *bbv_touched = NULL;
+static uint32_t nr_touched = 0;
+static uint64_t interval_begin = 0;
+
+// the intervals to save a checkpoint at, in ascending order
+static uint64_t *ckpt_interval = NULL;
+static int nr_ckpt = 0, next_ckpt = 0;
+static const char *ckpt_prefix = NULL;
+
+static inline BBVSlot* bbv_slot(BBVSlot *table, int shift, vaddr_t pc) {
+  uint64_t mask = (1ull << (64 - shift)) - 1;
+  uint64_t h = ((uint64_t)pc >> 1) * 0x9e3779b97f4a7c15ull >> shift;
+  while (table[h].id != 0 && table[h].pc != pc) h = (h + 1) & mask;
+  return &table[h];
+}
+
+static void bbv_grow() {
+  int shift = bbv_shift - 1;
+  BBVSlot *table = calloc(1ull << (64 - shift), sizeof(BBVSlot));
+  assert(table);
+  uint64_t i;
+  for (i = 0; i < (1ull << (64 - bbv_shift)); i ++) {
+    if (bbv_table[i].id != 0) *bbv_slot(table, shift, bbv_table[i].pc) = bbv_table[i];
+  }
+  free(bbv_table);
+  bbv_table = table;
+  bbv_shift = shift;
+}
+
+static uint32_t bbv_id(vaddr_t pc) {
+  BBVSlot *s = bbv_slot(bbv_table, bbv_shift, pc);
+  if (s->id != 0) return s->id;
+  s->pc = pc;
+  s->id = ++ nr_block;
+  if (nr_block >= count_size) {
+    count_size *= 2;
+    bbv_count = realloc(bbv_count, count_size * sizeof(bbv_count[0]));
+    bbv_touched = realloc(bbv_touched, count_size * sizeof(bbv_touched[0]));
+    assert(bbv_count && bbv_touched);
+    memset(bbv_count + count_size / 2, 0, count_size / 2 * sizeof(bbv_count[0]));
+  }
+  // keep the load factor below 1/2
+  if ((uint64_t)nr_block * 2 > (1ull << (64 - bbv_shift))) bbv_grow();
+  return nr_block;
+}
+
+// count the current block up to here
+static void bbv_add() {
+  if (bbv_len == 0) return;
+  uint32_t id = bbv_id(bbv_start);
+  if (bbv_count[id] == 0) bbv_touched[nr_touched ++] = id;
+  bbv_count[id] += bbv_len;
+  bbv_len = 0;
+}
+
+void bbv_jump(vaddr_t target) {
+  bbv_add();
+  bbv_start = target;
+}
+
+static void bbv_dump() {
+  bbv_add();
+  if (nr_touched == 0) return;
+  fputc('T', bbv_fp);
+  uint32_t i;
+  for (i = 0; i < nr_touched; i ++) {
+    uint32_t id = bbv_touched[i];
+    fprintf(bbv_fp, ":%" PRIu32 ":%" PRIu64 " ", id, bbv_count[id]);
+    bbv_count[id] = 0;
+  }
+  fputc('\n', bbv_fp);
+  nr_touched = 0;
+}
+
+static void save_checkpoint(uint64_t idx) {
+#ifdef CONFIG_CHECKPOINT
+  char file[4096];
+  snprintf(file, sizeof(file), "%s.%" PRIu64 ".ckpt", ckpt_prefix, idx);
+  Assert(checkpoint_save(file), "Can not save checkpoint %s", file);
+  Log("Checkpoint of interval %" PRIu64 " is saved to %s", idx, file);
+#endif
+}
+
+// the instruction count reaches the end of the current interval
+void simpoint_boundary() {
+  if (bbv_on && g_nr_guest_inst > interval_begin) bbv_dump();
+  if (g_nr_guest_inst % INTERVAL == 0) {
+    uint64_t idx = g_nr_guest_inst / INTERVAL;
+    // the intervals before a restored checkpoint are passed
+    while (next_ckpt < nr_ckpt && ckpt_interval[next_ckpt] < idx) next_ckpt ++;
+    if (next_ckpt < nr_ckpt && ckpt_interval[next_ckpt] == idx) {
+      save_checkpoint(idx);
+      next_ckpt ++;
+      if (next_ckpt == nr_ckpt && !bbv_on) {
+        Log("All checkpoints are saved");
+        nemu_state.state = NEMU_QUIT;
+      }
+    }
+  }
+  interval_begin = g_nr_guest_inst;
+  simpoint_next = (g_nr_guest_inst / INTERVAL + 1) * INTERVAL;
+}
+
+static void close_simpoint() {
+  if (bbv_fp == NULL) return;
+  // the last interval may be shorter
+  bbv_dump();
+  fclose(bbv_fp);
+  bbv_fp = NULL;
+}
+
+static int cmp_interval(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// each line of a simpoints file is "interval cluster"
+static void load_simpoints(const char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+  int size = 16;
+  ckpt_interval = malloc(size * sizeof(ckpt_interval[0]));
+  assert(ckpt_interval);
+  uint64_t idx;
+  while (fscanf(fp, "%" SCNu64 "%*[^\n]", &idx) == 1) {
+    if (nr_ckpt == size) {
+      size *= 2;
+      ckpt_interval = realloc(ckpt_interval, size * sizeof(ckpt_interval[0]));
+      assert(ckpt_interval);
+    }
+    ckpt_interval[nr_ckpt ++] = idx;
+  }
+  fclose(fp);
+  qsort(ckpt_interval, nr_ckpt, sizeof(ckpt_interval[0]), cmp_interval);
+  int i, n = 0;
+  for (i = 0; i < nr_ckpt; i ++) {
+    if (n == 0 || ckpt_interval[i] != ckpt_interval[n - 1]) ckpt_interval[n ++] = ckpt_interval[i];
+  }
+  nr_ckpt = n;
+  Log("Checkpoints are saved at the start of %d intervals of %" PRIu64 " instructions", nr_ckpt, INTERVAL);
+}
+
+void init_simpoint(const char *bbv_file, const char *simpoints_file) {
+  if (bbv_file != NULL) {
+    bbv_fp = fopen(bbv_file, "w");
+    Assert(bbv_fp, "Can not open '%s'", bbv_file);
+    bbv_shift = 64 - 12;
+    bbv_table = calloc(1ull << (64 - bbv_shift), sizeof(BBVSlot));
+    count_size = 1024;
+    bbv_count = calloc(count_size, sizeof(bbv_count[0]));
+    bbv_touched = malloc(count_size * sizeof(bbv_touched[0]));
+    assert(bbv_table && bbv_count && bbv_touched);
+    bbv_start = cpu.pc;
+    bbv_on = true;
+    atexit(close_simpoint);
+    Log("Basic block vectors of %" PRIu64 " instructions are written to %s", INTERVAL, bbv_file);
+  }
+  if (simpoints_file != NULL) {
+    IFNDEF(CONFIG_CHECKPOINT, panic("Checkpoints are not supported, enable CHECKPOINT in menuconfig"));
+    ckpt_prefix = simpoints_file;
+    load_simpoints(simpoints_file);
+  }
+  simpoint_on = bbv_on || nr_ckpt > 0;
+  interval_begin = g_nr_guest_inst;
+  simpoint_next = (g_nr_guest_inst + INTERVAL - 1) / INTERVAL * INTERVAL;
+}
+#endif
@@ -0,0 +1,117 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+
+typedef struct {
+  vaddr_t addr;
+  vaddr_t size; // 0 if unknown, then the symbol extends to the next one
+  const char *name;
+} Symbol;
+
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+// Read the function symbols from .symtab, handling both ELF classes.
+#define LOAD_SYMTAB(bits) do { \
+  Elf##bits##_Ehdr *eh = (void *)buf; \
+  Elf##bits##_Shdr *sh = (void *)(buf + eh->e_shoff); \
+  int i, j; \
+  for (i = 0; i < eh->e_shnum; i ++) { \
+    if (sh[i].sh_type != SHT_SYMTAB) continue; \
+    Elf##bits##_Sym *sym = (void *)(buf + sh[i].sh_offset); \
+    int nr = sh[i].sh_size / sizeof(*sym); \
+    Elf##bits##_Shdr *str = &sh[sh[i].sh_link]; \
+    strtab = malloc(str->sh_size); \
+    assert(strtab); \
+    memcpy(strtab, buf + str->sh_offset, str->sh_size); \
+    syms = malloc(sizeof(Symbol) * nr); \
+    assert(syms); \
+    for (j = 0; j < nr; j ++) { \
+      int type = ELF##bits##_ST_TYPE(sym[j].st_info); \
+      int shndx = sym[j].st_shndx; \
+      /* labels in assembly, e.g. _start, are untyped */ \
+      bool is_code = (type == STT_FUNC) || (type == STT_NOTYPE && shndx > 0 && \
+          shndx < eh->e_shnum && (sh[shndx].sh_flags & SHF_EXECINSTR) && strtab[sym[j].st_name] != '\0' && \
+          strtab[sym[j].st_name] != '.' && strtab[sym[j].st_name] != '$'); \
+      if (!is_code || sym[j].st_value == 0) continue; \
+      syms[nr_sym ++] = (Symbol) { .addr = sym[j].st_value, .size = sym[j].st_size, \
+        .name = strtab + sym[j].st_name }; \
+    } \
+    break; \
+  } \
+} while (0)
+
+void init_symbol(const char *elf_file) {
+  if (elf_file == NULL) return;
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  char magic[SELFMAG];
+  if (fread(magic, SELFMAG, 1, fp) != 1 || memcmp(magic, ELFMAG, SELFMAG) != 0) {
+    // a raw image has no symbol
+    fclose(fp);
+    return;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+  if (buf[EI_CLASS] == ELFCLASS64) { LOAD_SYMTAB(64); }
+  else { LOAD_SYMTAB(32); }
+  free(buf);
+
+  qsort(syms, nr_sym, sizeof(Symbol), sym_cmp);
+  Log("Read %d function symbols from %s", nr_sym, elf_file);
+}
+
+const char* symbol_lookup(vaddr_t addr, vaddr_t *start) {
+  // find the last symbol starting at or before `addr`
+  int l = 0, r = nr_sym - 1, found = -1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (syms[m].addr <= addr) { found = m; l = m + 1; }
+    else { r = m - 1; }
+  }
+  if (found < 0) return NULL;
+  Symbol *s = &syms[found];
+  if (s->size != 0 && addr - s->addr >= s->size) return NULL;
+  if (start != NULL) *start = s->addr;
+  return s->name;
+}
+
+bool symbol_addr(const char *name, vaddr_t *addr) {
+  int i;
+  for (i = 0; i < nr_sym; i ++) {
+    if (strcmp(syms[i].name, name) == 0) {
+      *addr = syms[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
+#endif
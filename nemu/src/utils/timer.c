@@ -43,3 +43,8 @@ uint64_t get_time() {
   uint64_t now = get_time_internal();
   return now - boot_time;
 }
+
+// make get_time() continue from `us`, e.g. when a snapshot is restored
+void set_time(uint64_t us) {
+  boot_time = get_time_internal() - us;
+}
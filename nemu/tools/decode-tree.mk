@@ -0,0 +1,35 @@
+#***************************************************************************************
+# Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+ifneq ($(CONFIG_DECODE_TREE)$(CONFIG_INST_STAT),)
+GEN_DECODE_PATH = $(NEMU_HOME)/tools/gen-decode
+GEN_DECODE = $(GEN_DECODE_PATH)/build/gen-decode
+DECODE_TREE = $(OBJ_DIR)/generated/decode-tree.h
+INST_SRC = src/isa/$(GUEST_ISA)/inst.c
+
+$(GEN_DECODE): $(GEN_DECODE_PATH)/gen-decode.c
+	$(MAKE) -s -C $(GEN_DECODE_PATH)
+
+$(DECODE_TREE): $(INST_SRC) $(GEN_DECODE)
+	@echo + GEN $@
+	@mkdir -p $(dir $@)
+	@$(GEN_DECODE) $(INST_SRC) > $@.tmp
+	@mv $@.tmp $@
+
+$(OBJ_DIR)/src/isa/$(GUEST_ISA)/inst.o: $(DECODE_TREE)
+# and every object including <cpu/inst-stat.h>
+$(OBJ_DIR)/src/cpu/inst-stat.o $(OBJ_DIR)/src/cpu/cpu-exec.o: $(DECODE_TREE)
+CFLAGS += -I$(dir $(DECODE_TREE))
+endif
@@ -0,0 +1,233 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Generate a decision tree from the INSTPAT table of an ISA.
+ *
+ * Usage: gen-decode inst.c > decode-tree.h
+ *
+ * The output defines
+ *   INSTPAT_LIST(f): f(name) for each pattern, in the order of the table
+ *   decode_tree(inst): the index of the first pattern matching `inst`, or -1
+ *
+ * decode_tree() switches on opcode, funct3 and funct7 in turn, but only on
+ * fields which tell the remaining candidates apart. The few candidates left
+ * at a leaf are compared in the order of the table, so the result is always
+ * the same as matching the patterns one by one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_PAT 1024
+#define INST_BITS 32
+
+typedef struct {
+  char name[64];
+  uint32_t key, mask;
+} Pattern;
+
+typedef struct {
+  int hi, lo;
+} Field;
+
+static Pattern pat[MAX_PAT];
+static int nr_pat = 0;
+
+static const Field fields[] = {
+  { 6, 0 },   // opcode
+  { 14, 12 }, // funct3
+  { 31, 25 }, // funct7
+};
+#define NR_FIELD (int)(sizeof(fields) / sizeof(fields[0]))
+
+static void fail(const char *file, int lineno, const char *msg) {
+  fprintf(stderr, "%s:%d: %s\n", file, lineno, msg);
+  exit(1);
+}
+
+static void parse_line(const char *file, int lineno, const char *line) {
+  const char *p = line;
+  while (isspace(*p)) p ++;
+  // only take the uses of INSTPAT, not its definition or comments
+  if (strncmp(p, "INSTPAT(\"", 9) != 0) return;
+  p += 9;
+
+  Pattern *pt = &pat[nr_pat];
+  int nr_bit = 0;
+  pt->key = pt->mask = 0;
+  for (; *p != '"'; p ++) {
+    if (*p == ' ') continue;
+    if (*p != '0' && *p != '1' && *p != '?') fail(file, lineno, "invalid character in pattern");
+    pt->key  = (pt->key  << 1) | (*p == '1');
+    pt->mask = (pt->mask << 1) | (*p != '?');
+    nr_bit ++;
+  }
+  if (nr_bit != INST_BITS) fail(file, lineno, "pattern should be 32 bits");
+
+  p ++;
+  while (isspace(*p) || *p == ',') p ++;
+  int len = 0;
+  while (isalnum(*p) || *p == '_') {
+    if (len + 1 >= sizeof(pt->name)) fail(file, lineno, "name too long");
+    pt->name[len ++] = *p ++;
+  }
+  pt->name[len] = '\0';
+  if (len == 0) fail(file, lineno, "missing name");
+
+  if (nr_pat + 1 >= MAX_PAT) fail(file, lineno, "too many patterns");
+  nr_pat ++;
+}
+
+// A candidate list holds the indices of the patterns which may match
+// an instruction whose bits under `fmask` are `fval`, in table order.
+// It stops at the first pattern fully decided by these bits, since
+// the patterns after it can never be chosen.
+static int filter(const int *in, int n, uint32_t fmask, uint32_t fval, int *out) {
+  int i, m = 0;
+  for (i = 0; i < n; i ++) {
+    Pattern *pt = &pat[in[i]];
+    if (((pt->key ^ fval) & pt->mask & fmask) != 0) continue;
+    out[m ++] = in[i];
+    if ((pt->mask & ~fmask) == 0) break;
+  }
+  return m;
+}
+
+static bool same_list(const int *a, int na, const int *b, int nb) {
+  return na == nb && memcmp(a, b, sizeof(a[0]) * na) == 0;
+}
+
+static void indent(int depth) {
+  printf("%*s", depth * 2, "");
+}
+
+static void gen_leaf(const int *cand, int n, uint32_t fmask, int depth) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    Pattern *pt = &pat[cand[i]];
+    uint32_t rest = pt->mask & ~fmask;
+    indent(depth);
+    if (rest == 0) {
+      printf("return %d; // %s\n", cand[i], pt->name);
+      return;
+    }
+    printf("if ((inst & 0x%08x) == 0x%08x) return %d; // %s\n", rest, pt->key & rest, cand[i], pt->name);
+  }
+  indent(depth);
+  printf("return -1;\n");
+}
+
+static void gen_tree(int level, const int *cand, int n, uint32_t fmask, uint32_t fval, int depth) {
+  if (level == NR_FIELD || n <= 1) {
+    gen_leaf(cand, n, fmask, depth);
+    return;
+  }
+
+  const Field *f = &fields[level];
+  int width = f->hi - f->lo + 1;
+  int nr_val = 1 << width;
+  uint32_t mask = (((1u << width) - 1) << f->lo);
+  int (*sub)[MAX_PAT] = malloc(sizeof(*sub) * nr_val);
+  int *nr_sub = malloc(sizeof(int) * nr_val);
+  int v, w;
+  bool all_same = true;
+  for (v = 0; v < nr_val; v ++) {
+    nr_sub[v] = filter(cand, n, fmask | mask, fval | ((uint32_t)v << f->lo), sub[v]);
+    all_same = all_same && same_list(sub[v], nr_sub[v], sub[0], nr_sub[0]);
+  }
+
+  if (all_same) {
+    // this field does not tell the candidates apart
+    gen_tree(level + 1, cand, n, fmask, fval, depth);
+  } else {
+    // the most common list goes to `default`
+    int dflt = 0, best = 0;
+    for (v = 0; v < nr_val; v ++) {
+      int cnt = 0;
+      for (w = 0; w < nr_val; w ++) {
+        cnt += same_list(sub[v], nr_sub[v], sub[w], nr_sub[w]);
+      }
+      if (cnt > best) { best = cnt; dflt = v; }
+    }
+
+    indent(depth);
+    printf("switch ((inst >> %d) & 0x%x) {\n", f->lo, nr_val - 1);
+    bool *done = calloc(nr_val, sizeof(bool));
+    for (v = 0; v < nr_val; v ++) {
+      if (done[v] || same_list(sub[v], nr_sub[v], sub[dflt], nr_sub[dflt])) continue;
+      indent(depth);
+      for (w = v; w < nr_val; w ++) {
+        if (!done[w] && same_list(sub[v], nr_sub[v], sub[w], nr_sub[w])) {
+          printf("case 0x%x: ", w);
+          done[w] = true;
+        }
+      }
+      printf("{\n");
+      gen_tree(level + 1, sub[v], nr_sub[v], fmask | mask, fval | ((uint32_t)v << f->lo), depth + 1);
+      indent(depth);
+      printf("}\n");
+    }
+    indent(depth);
+    printf("default: {\n");
+    gen_tree(level + 1, sub[dflt], nr_sub[dflt], fmask | mask, fval | ((uint32_t)dflt << f->lo), depth + 1);
+    indent(depth);
+    printf("}\n");
+    indent(depth);
+    printf("}\n");
+    free(done);
+  }
+
+  free(sub);
+  free(nr_sub);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s inst.c\n", argv[0]);
+    return 1;
+  }
+  FILE *fp = fopen(argv[1], "r");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  char line[4096];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    parse_line(argv[1], ++ lineno, line);
+  }
+  fclose(fp);
+
+  int i, all[MAX_PAT];
+  for (i = 0; i < nr_pat; i ++) all[i] = i;
+
+  printf("// Generated by tools/gen-decode from %s. DO NOT EDIT.\n\n", argv[1]);
+  printf("#ifndef __DECODE_TREE_H__\n#define __DECODE_TREE_H__\n\n");
+  printf("#define INSTPAT_LIST(f)");
+  for (i = 0; i < nr_pat; i ++) printf(" f(%s)", pat[i].name);
+  printf("\n");
+  printf("#define INSTPAT_KEYS(f)");
+  for (i = 0; i < nr_pat; i ++) printf(" f(%s, 0x%x, 0x%x)", pat[i].name, pat[i].key, pat[i].mask);
+  printf("\n\n");
+  printf("static inline int decode_tree(uint32_t inst) {\n");
+  gen_tree(0, all, filter(all, nr_pat, 0, 0, all), 0, 0, 1);
+  printf("}\n\n");
+  printf("#endif\n");
+  return 0;
+}
@@ -0,0 +1,158 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Print the binary instruction trace written by NEMU with --btrace,
+ * or the function call trace written with --ftrace.
+ *
+ * Usage: nemu-trace [-n COUNT] FILE
+ *
+ * Records are printed from the oldest one kept in the ring buffer,
+ * with -n only the last COUNT records are printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <btrace-def.h>
+#include <ftrace-def.h>
+
+void init_disasm(const char *triple);
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+
+// whether the instruction writes an integer register
+static bool riscv_has_rd(uint32_t inst, uint32_t rd) {
+  switch (inst & 0x7f) {
+    case 0x23: case 0x63: case 0x0f: return false; // store, branch, fence
+    case 0x07: case 0x27: case 0x43: case 0x47:
+    case 0x4b: case 0x4f: case 0x53: return false; // floating point
+    default: return rd != 0;
+  }
+}
+
+// print the events indented by their depth
+static int print_ftrace(const char *file, uint8_t *p, size_t size, uint64_t count) {
+  FTraceHeader *hdr = (void *)p;
+  if (hdr->version != FTRACE_VERSION) {
+    fprintf(stderr, "%s: not a NEMU function trace of version %d\n", file, FTRACE_VERSION);
+    return 1;
+  }
+  uint64_t nr_slot = hdr->nr_slot;
+  uint64_t nr_event = hdr->nr_event;
+  uint64_t first = (nr_event > nr_slot ? nr_event - nr_slot : 0);
+  if (count != 0 && nr_event - first > count) first = nr_event - count;
+  if (FTRACE_HDR_SIZE + (nr_event - first) * sizeof(FTraceEvent) > size) {
+    fprintf(stderr, "%s: truncated trace\n", file);
+    return 1;
+  }
+  int w = (strcmp(hdr->isa, "riscv64") == 0 ? 16 : 8);
+
+  FTraceEvent *ring = (void *)(p + FTRACE_HDR_SIZE);
+  uint64_t i;
+  for (i = first; i < nr_event; i ++) {
+    FTraceEvent *e = &ring[i & (nr_slot - 1)];
+    int indent = (e->type == FTRACE_CALL ? e->depth - 1 : e->depth) * 2;
+    printf("%12" PRIu64 "  0x%0*" PRIx64 ": %*s%s [0x%0*" PRIx64 "]\n", e->icount, w, e->pc,
+        indent, "", (e->type == FTRACE_CALL ? "call" : "ret "), w, e->target);
+  }
+  if (nr_event > nr_slot) {
+    fprintf(stderr, "%s: the first %" PRIu64 " events were overwritten\n", file, nr_event - nr_slot);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t count = 0;
+  int o;
+  while ((o = getopt(argc, argv, "n:")) != -1) {
+    switch (o) {
+      case 'n': count = strtoull(optarg, NULL, 0); break;
+      default: goto usage;
+    }
+  }
+  if (optind + 1 != argc) {
+usage:
+    fprintf(stderr, "Usage: %s [-n COUNT] FILE\n", argv[0]);
+    return 1;
+  }
+
+  const char *file = argv[optind];
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) { perror(file); return 1; }
+  struct stat st;
+  fstat(fd, &st);
+  if (st.st_size < BTRACE_HDR_SIZE) { fprintf(stderr, "%s: file too short\n", file); return 1; }
+  uint8_t *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) { perror(file); return 1; }
+
+  if (memcmp(p, FTRACE_MAGIC, sizeof(FTRACE_MAGIC)) == 0) {
+    int ret = print_ftrace(file, p, st.st_size, count);
+    munmap(p, st.st_size);
+    close(fd);
+    return ret;
+  }
+
+  BTraceHeader *hdr = (void *)p;
+  if (memcmp(hdr->magic, BTRACE_MAGIC, sizeof(BTRACE_MAGIC)) != 0 || hdr->version != BTRACE_VERSION) {
+    fprintf(stderr, "%s: not a NEMU binary trace of version %d\n", file, BTRACE_VERSION);
+    return 1;
+  }
+  if (hdr->record_size != BTRACE_RECORD_SIZE(hdr->flags)) {
+    fprintf(stderr, "%s: bad record size %u\n", file, hdr->record_size);
+    return 1;
+  }
+
+  uint64_t nr_slot = hdr->nr_slot;
+  uint64_t nr_record = hdr->nr_record;
+  uint64_t first = (nr_record > nr_slot ? nr_record - nr_slot : 0);
+  if (count != 0 && nr_record - first > count) first = nr_record - count;
+  if (BTRACE_HDR_SIZE + (nr_record - first) * hdr->record_size > st.st_size) {
+    fprintf(stderr, "%s: truncated trace\n", file);
+    return 1;
+  }
+
+  char triple[64];
+  snprintf(triple, sizeof(triple), "%s-pc-linux-gnu", hdr->isa);
+  init_disasm(triple);
+  bool is64 = (strcmp(hdr->isa, "riscv64") == 0);
+
+  uint8_t *ring = p + BTRACE_HDR_SIZE;
+  uint64_t i;
+  for (i = first; i < nr_record; i ++) {
+    BTraceRecord *r = (void *)(ring + (i & (nr_slot - 1)) * hdr->record_size);
+    char asm_buf[128];
+    disassemble(asm_buf, sizeof(asm_buf), r->pc, (uint8_t *)&r->inst, 4);
+    if (is64) printf("0x%016" PRIx64 ": %08x  ", r->pc, r->inst);
+    else printf("0x%08" PRIx64 ": %08x  ", r->pc, r->inst);
+    if ((hdr->flags & BTRACE_HAS_RD) && riscv_has_rd(r->inst, r->rd)) {
+      printf("%-32s  x%u = 0x%0*" PRIx64, asm_buf, r->rd, is64 ? 16 : 8, r->rd_val);
+    } else {
+      printf("%s", asm_buf);
+    }
+    printf("\n");
+  }
+
+  if (nr_record > nr_slot) {
+    fprintf(stderr, "%s: the first %" PRIu64 " records were overwritten\n", file, nr_record - nr_slot);
+  }
+  munmap(p, st.st_size);
+  close(fd);
+  return 0;
+}